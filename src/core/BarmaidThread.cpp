@@ -0,0 +1,310 @@
+#include "BarmaidThread.hpp"
+#include "ProtocolHandler.hpp"
+#include "../helpers/Logger.hpp"
+
+#include <cerrno>
+#include <ranges>
+
+#include <sys/eventfd.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+constexpr const uint32_t               KV_PROTOCOL_VERSION   = 1;
+constexpr const uint32_t               MAID_PROTOCOL_VERSION = 1;
+
+static SP<CCHpHyprtavernCoreV1Impl>    clientCoreImpl    = makeShared<CCHpHyprtavernCoreV1Impl>(TAVERN_PROTOCOL_VERSION);
+static SP<CCHpHyprtavernKvStoreV1Impl> clientKvImpl      = makeShared<CCHpHyprtavernKvStoreV1Impl>(KV_PROTOCOL_VERSION);
+static SP<CCHpHyprtavernBarmaidV1Impl> clientBarmaidImpl = makeShared<CCHpHyprtavernBarmaidV1Impl>(MAID_PROTOCOL_VERSION);
+
+CBarmaidThread::~CBarmaidThread() {
+    stop();
+
+    if (m_requestFD >= 0)
+        close(m_requestFD);
+}
+
+void CBarmaidThread::stop() {
+    if (!m_thread.joinable())
+        return;
+
+    m_stop = true;
+
+    const uint64_t ONE = 1;
+    write(m_requestFD, &ONE, sizeof(ONE));
+
+    // init waits on the tavern and the kv without looking at m_requestFD, cut those off. Both sockets outlive the thread
+    shutdown(m_tavernSock->extractLoopFD(), SHUT_RDWR);
+    if (const int KV_FD = m_kvFD; KV_FD >= 0)
+        shutdown(KV_FD, SHUT_RDWR);
+
+    m_thread.join();
+}
+
+bool CBarmaidThread::start(SP<Hyprwire::IClientSocket>&& tavernSock, std::function<void()>&& notify) {
+    m_requestFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (m_requestFD < 0) {
+        g_logger->log(LOG_ERR, "CBarmaidThread::start: failed to create an eventfd");
+        return false;
+    }
+
+    m_tavernSock = std::move(tavernSock);
+    m_notify     = std::move(notify);
+    m_thread     = std::thread([this] { run(); });
+
+    return true;
+}
+
+void CBarmaidThread::getValue(const std::string& key) {
+    request(SBarmaidRequest{.type = SBarmaidRequest::BARMAID_REQUEST_GET_VALUE, .key = key});
+}
+
+void CBarmaidThread::setValue(const std::string& key, const std::string& value) {
+    request(SBarmaidRequest{.type = SBarmaidRequest::BARMAID_REQUEST_SET_VALUE, .key = key, .value = value});
+}
+
+void CBarmaidThread::updateEnvironment(const std::vector<const char*>& names, const std::vector<const char*>& values) {
+    request(SBarmaidRequest{
+        .type   = SBarmaidRequest::BARMAID_REQUEST_UPDATE_ENVIRONMENT,
+        .names  = {names.begin(), names.end()},
+        .values = {values.begin(), values.end()},
+    });
+}
+
+void CBarmaidThread::request(SBarmaidRequest&& req) {
+    // everything goes through the backlog, so nothing jumps it
+    m_backlog.emplace_back(std::move(req));
+    flushBacklog();
+}
+
+void CBarmaidThread::flushBacklog() {
+    if (m_backlog.empty())
+        return;
+
+    // flag first, then push. Either the push sees the room handleRequests() made, or handleRequests() sees the flag and notifies
+    m_backlogged = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    bool pushed = false;
+
+    while (!m_backlog.empty() && m_requests.push(std::move(m_backlog.front()))) {
+        m_backlog.pop_front();
+        pushed = true;
+    }
+
+    if (m_backlog.empty())
+        m_backlogged = false;
+
+    if (!pushed)
+        return;
+
+    const uint64_t ONE = 1;
+    write(m_requestFD, &ONE, sizeof(ONE));
+}
+
+void CBarmaidThread::dispatch(const std::function<void(SBarmaidEvent&)>& fn) {
+    flushBacklog();
+
+    while (auto ev = m_events.pop()) {
+        fn(*ev);
+    }
+
+    // pairs with pushEvent(): either its retry sees the room made above, or we see its flag here
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (m_eventsFull.exchange(false)) {
+        const uint64_t ONE = 1;
+        write(m_requestFD, &ONE, sizeof(ONE));
+    }
+}
+
+void CBarmaidThread::pushEvent(SBarmaidEvent&& ev) {
+    // this thread can afford to wait, the main loop can't
+    while (!m_events.push(std::move(ev))) {
+        // flag first, then retry. A push only moves on success, so ev is still there
+        m_eventsFull = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (m_events.push(std::move(ev)))
+            break;
+
+        m_notify();
+
+        // sleep until dispatch() made room, or a request or stop() came in
+        pollfd fd = {.fd = m_requestFD, .events = POLLIN};
+        if (poll(&fd, 1, -1) < 0 && errno != EINTR) {
+            g_logger->log(LOG_ERR, "CBarmaidThread::pushEvent: poll() failed, dropping an event");
+            return;
+        }
+
+        // that might have eaten a request wakeup, run() picks those up
+        uint64_t count = 0;
+        read(m_requestFD, &count, sizeof(count));
+        m_requestsPending = true;
+
+        if (m_stop)
+            return;
+    }
+
+    m_notify();
+}
+
+void CBarmaidThread::run() {
+    if (!init()) {
+        pushEvent(SBarmaidEvent{.type = SBarmaidEvent::BARMAID_EVENT_FAILED});
+        return;
+    }
+
+    pushEvent(SBarmaidEvent{.type = SBarmaidEvent::BARMAID_EVENT_READY});
+
+    pollfd fds[2] = {
+        pollfd{
+            .fd     = m_kvSock->extractLoopFD(),
+            .events = POLLIN,
+        },
+        pollfd{
+            .fd     = m_requestFD,
+            .events = POLLIN,
+        },
+    };
+
+    while (!m_stop) {
+        if (poll(fds, 2, m_requestsPending ? 0 : -1) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            g_logger->log(LOG_ERR, "CBarmaidThread::run: poll() failed");
+            pushEvent(SBarmaidEvent{.type = SBarmaidEvent::BARMAID_EVENT_FAILED});
+            return;
+        }
+
+        if ((fds[1].revents & POLLIN) || m_requestsPending) {
+            uint64_t count = 0;
+            read(m_requestFD, &count, sizeof(count));
+
+            m_requestsPending = false;
+            handleRequests();
+        }
+
+        if ((fds[0].revents & POLLIN) && !m_kvSock->dispatchEvents()) {
+            g_logger->log(LOG_ERR, "CBarmaidThread::run: kv dispatch failed");
+            pushEvent(SBarmaidEvent{.type = SBarmaidEvent::BARMAID_EVENT_FAILED});
+            return;
+        }
+
+        if (fds[0].revents & POLLHUP) {
+            g_logger->log(LOG_ERR, "tavernkeep fd died");
+            pushEvent(SBarmaidEvent{.type = SBarmaidEvent::BARMAID_EVENT_FAILED});
+            return;
+        }
+    }
+}
+
+void CBarmaidThread::handleRequests() {
+    while (auto req = m_requests.pop()) {
+        switch (req->type) {
+            case SBarmaidRequest::BARMAID_REQUEST_GET_VALUE:
+                m_kvManager->sendGetValue(req->key.c_str(), HP_HYPRTAVERN_KV_STORE_V1_VALUE_TYPE_TAVERN_VALUE);
+                break;
+            case SBarmaidRequest::BARMAID_REQUEST_SET_VALUE:
+                m_kvManager->sendSetValue(req->key.c_str(), req->value.c_str(), HP_HYPRTAVERN_KV_STORE_V1_VALUE_TYPE_TAVERN_VALUE);
+                break;
+            case SBarmaidRequest::BARMAID_REQUEST_UPDATE_ENVIRONMENT: {
+                const auto NAMES  = req->names | std::views::transform([](const auto& s) { return s.c_str(); }) | std::ranges::to<std::vector<const char*>>();
+                const auto VALUES = req->values | std::views::transform([](const auto& s) { return s.c_str(); }) | std::ranges::to<std::vector<const char*>>();
+                m_kvBarmaidManager->sendUpdateTavernEnvironment(NAMES, VALUES);
+                break;
+            }
+        }
+    }
+
+    // the main thread is sitting on requests that didn't fit, there's room now. Pairs with the fence in flushBacklog()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (m_backlogged)
+        m_notify();
+}
+
+bool CBarmaidThread::init() {
+    if (!m_tavernSock->waitForHandshake()) {
+        g_logger->log(LOG_ERR, "CBarmaidThread::init: tavern handshake failed");
+        return false;
+    }
+
+    m_tavernSock->addImplementation(clientCoreImpl);
+
+    const auto SPEC = m_tavernSock->getSpec(clientCoreImpl->protocol()->specName());
+
+    if (!SPEC) {
+        g_logger->log(LOG_ERR, "CBarmaidThread::init: failed because tavern doesn't support tavern proto??");
+        return false;
+    }
+
+    // get the handle
+    auto manager = makeShared<CCHpHyprtavernCoreManagerV1Object>(m_tavernSock->bindProtocol(clientCoreImpl->protocol(), TAVERN_PROTOCOL_VERSION));
+
+    auto query = makeShared<CCHpHyprtavernBusQueryV1Object>(
+        manager->sendGetQueryObject({"hp_hyprtavern_kv_store_v1"}, HP_HYPRTAVERN_CORE_V1_BUS_QUERY_FILTER_MODE_ALL, {}, HP_HYPRTAVERN_CORE_V1_BUS_QUERY_FILTER_MODE_ALL));
+
+    int fd = -1;
+
+    query->setResults([this, &manager, &fd](const std::vector<uint32_t>& res) {
+        if (res.empty())
+            return;
+
+        auto handle = makeShared<CCHpHyprtavernBusObjectHandleV1Object>(manager->sendGetObjectHandle(res[0]));
+        handle->setSocket([&fd](int connFd) { fd = connFd; });
+        handle->sendConnect();
+
+        m_tavernSock->roundtrip();
+    });
+
+    m_tavernSock->roundtrip();
+
+    if (fd < 0) {
+        g_logger->log(LOG_ERR, "CBarmaidThread::init: failed cuz bus has no kv?");
+        return false;
+    }
+
+    m_kvSock = Hyprwire::IClientSocket::open(fd);
+    m_kvFD   = fd;
+
+    if (m_stop)
+        return false;
+
+    if (!m_kvSock->waitForHandshake()) {
+        g_logger->log(LOG_ERR, "CBarmaidThread::init: handshake failed");
+        return false;
+    }
+
+    m_kvSock->addImplementation(clientKvImpl);
+    m_kvSock->addImplementation(clientBarmaidImpl);
+
+    // handshake is estabilished
+
+    m_kvManager        = makeShared<CCHpHyprtavernKvStoreManagerV1Object>(m_kvSock->bindProtocol(clientKvImpl->protocol(), KV_PROTOCOL_VERSION));
+    m_kvBarmaidManager = makeShared<CCHpHyprtavernBarmaidManagerV1Object>(m_kvSock->bindProtocol(clientBarmaidImpl->protocol(), MAID_PROTOCOL_VERSION));
+
+    bool maidReady = false;
+
+    m_kvBarmaidManager->setReady([&maidReady] { maidReady = true; });
+    m_kvManager->setStoreAvailable([this] { pushEvent(SBarmaidEvent{.type = SBarmaidEvent::BARMAID_EVENT_STORE_AVAILABLE}); });
+    m_kvManager->setValueObtained([this](const char* k, const char* v, uint32_t type) { pushEvent(SBarmaidEvent{.type = SBarmaidEvent::BARMAID_EVENT_VALUE, .key = k, .value = v}); });
+    // a key the kv doesn't have reads as empty, whoever waits on it still needs an answer
+    m_kvManager->setValueFailed([this](const char* k, uint32_t type, uint32_t error) { pushEvent(SBarmaidEvent{.type = SBarmaidEvent::BARMAID_EVENT_VALUE, .key = k}); });
+
+    while (true) {
+        if (m_stop || !m_kvSock->dispatchEvents(true)) {
+            g_logger->log(LOG_ERR, "CBarmaidThread::init: failed, barmaid died");
+            return false;
+        }
+
+        if (maidReady) {
+            g_logger->log(LOG_DEBUG, "CBarmaidThread::init: kv barmaid ready");
+            break;
+        }
+    }
+
+    return true;
+}
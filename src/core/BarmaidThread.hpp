@@ -0,0 +1,107 @@
+#pragma once
+
+#include <hyprwire/hyprwire.hpp>
+#include <hp_hyprtavern_core_v1-client.hpp>
+#include <hp_hyprtavern_kv_store_v1-client.hpp>
+#include <hp_hyprtavern_barmaid_v1-client.hpp>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../helpers/Memory.hpp"
+#include "../helpers/SPSCQueue.hpp"
+
+// main loop -> barmaid thread
+struct SBarmaidRequest {
+    enum eType : uint8_t {
+        BARMAID_REQUEST_GET_VALUE = 0,
+        BARMAID_REQUEST_SET_VALUE,
+        BARMAID_REQUEST_UPDATE_ENVIRONMENT,
+    };
+
+    eType                    type = BARMAID_REQUEST_GET_VALUE;
+
+    std::string              key, value;    // kv
+    std::vector<std::string> names, values; // environment
+};
+
+// barmaid thread -> main loop
+struct SBarmaidEvent {
+    enum eType : uint8_t {
+        BARMAID_EVENT_READY = 0,
+        BARMAID_EVENT_FAILED, // init failed or a barmaid died, nothing comes after
+        BARMAID_EVENT_STORE_AVAILABLE,
+        BARMAID_EVENT_VALUE, // value is empty if the kv doesn't have the key
+    };
+
+    eType       type = BARMAID_EVENT_READY;
+    std::string key, value;
+};
+
+// Owns every socket to the barmaids and talks to them on its own thread, so a slow kv (say, one waiting on a password
+// prompt) never holds up client dispatch. The main loop only ever sees the two queues below.
+class CBarmaidThread {
+  public:
+    CBarmaidThread() = default;
+    ~CBarmaidThread();
+
+    CBarmaidThread(const CBarmaidThread&) = delete;
+    CBarmaidThread(CBarmaidThread&)       = delete;
+    CBarmaidThread(CBarmaidThread&&)      = delete;
+
+    // takes over the tavern's connection to itself, which is needed to find the kv on the bus. notify is called on the
+    // barmaid thread whenever there are events to pop
+    bool start(SP<Hyprwire::IClientSocket>&& tavernSock, std::function<void()>&& notify);
+
+    // joins the thread, nothing is notified after. Safe to call more than once
+    void stop();
+
+    // main thread only. These never block, if the barmaid thread falls behind, requests wait on the main thread's side
+    void getValue(const std::string& key);
+    void setValue(const std::string& key, const std::string& value);
+    void updateEnvironment(const std::vector<const char*>& names, const std::vector<const char*>& values);
+
+    // main thread only, pops every event waiting
+    void dispatch(const std::function<void(SBarmaidEvent&)>& fn);
+
+  private:
+    constexpr static size_t QUEUE_SIZE = 256;
+
+    void                    request(SBarmaidRequest&& req);
+    void                    flushBacklog();
+
+    // barmaid thread
+    void                                     run();
+    bool                                     init();
+    void                                     handleRequests();
+    void                                     pushEvent(SBarmaidEvent&& ev);
+
+    SP<Hyprwire::IClientSocket>              m_tavernSock, m_kvSock;
+    SP<CCHpHyprtavernKvStoreManagerV1Object> m_kvManager;
+    SP<CCHpHyprtavernBarmaidManagerV1Object> m_kvBarmaidManager;
+
+    CSPSCQueue<SBarmaidRequest, QUEUE_SIZE>  m_requests;
+    CSPSCQueue<SBarmaidEvent, QUEUE_SIZE>    m_events;
+
+    // eventfd, wakes the barmaid thread up for requests or to stop
+    int                   m_requestFD = -1;
+    std::function<void()> m_notify;
+
+    // requests that didn't fit into the queue yet. The barmaid thread notifies when it made room
+    std::deque<SBarmaidRequest> m_backlog;
+    std::atomic<bool>           m_backlogged = false;
+
+    // the barmaid thread waits on m_requestFD while the event queue is full, dispatch() kicks it once it made room.
+    // Waiting eats request wakeups, m_requestsPending remembers them
+    std::atomic<bool> m_eventsFull      = false;
+    bool              m_requestsPending = false;
+
+    // for unblocking the thread on the way out, it may be stuck waiting on a barmaid
+    std::atomic<int>  m_kvFD = -1;
+    std::atomic<bool> m_stop = false;
+    std::thread       m_thread;
+};
@@ -0,0 +1,229 @@
+#include "BusIndex.hpp"
+#include "ProtocolHandler.hpp"
+#include "../helpers/AtomTable.hpp"
+
+#include <algorithm>
+#include <format>
+
+//
+uint32_t CBusIndex::slotOf(uint32_t id) {
+    return id & CSlotMap<CBusObject>::INDEX_MASK;
+}
+
+void CBusIndex::addObject(uint32_t id) {
+    m_epoch++;
+
+    const auto SLOT = slotOf(id);
+
+    if (SLOT >= m_slotIds.size())
+        m_slotIds.resize(SLOT + 1, 0);
+
+    m_slotIds[SLOT] = id;
+    m_all.set(SLOT);
+}
+
+void CBusIndex::removeObject(const CBusObject& obj) {
+    m_epoch++;
+
+    const auto SLOT = slotOf(obj.m_internalID);
+
+    for (const auto& p : obj.m_protocols) {
+        auto it = m_protocols.find(p.name);
+        if (it == m_protocols.end())
+            continue;
+
+        it->second.objects.clear(SLOT);
+        m_restrictedProtocols -= it->second.requiredPerms.erase(SLOT);
+
+        if (!it->second.objects.empty())
+            continue;
+
+        m_protocolTrie.erase(g_atoms->str(p.name));
+        m_protocols.erase(it);
+    }
+
+    for (const auto& [k, v] : obj.m_props) {
+        removeProperty(obj.m_internalID, k, v);
+    }
+
+    m_all.clear(SLOT);
+
+    if (SLOT < m_slotIds.size())
+        m_slotIds[SLOT] = 0;
+
+    if (SLOT < m_slotProtocols.size())
+        m_slotProtocols[SLOT].clear();
+}
+
+void CBusIndex::addProtocol(uint32_t id, uint32_t name, const SPermissionSet& perms) {
+    m_epoch++;
+
+    const auto SLOT = slotOf(id);
+    auto       it   = m_protocols.find(name);
+
+    if (it == m_protocols.end()) {
+        it = m_protocols.emplace(name, SProtocolEntry{}).first;
+        m_protocolTrie.insert(g_atoms->str(name), &it->second);
+    }
+
+    if (!it->second.objects.test(SLOT)) {
+        if (SLOT >= m_slotProtocols.size())
+            m_slotProtocols.resize(SLOT + 1);
+
+        m_slotProtocols[SLOT].emplace_back(name);
+    }
+
+    it->second.objects.set(SLOT);
+
+    m_restrictedProtocols -= it->second.requiredPerms.erase(SLOT);
+
+    if (!perms.empty()) {
+        it->second.requiredPerms.emplace(SLOT, perms);
+        m_restrictedProtocols++;
+    }
+}
+
+void CBusIndex::addProperty(uint32_t id, uint32_t key, const std::string_view& value) {
+    m_epoch++;
+
+    const auto PROP = std::format("{}={}", g_atoms->str(key), value);
+    auto       it   = m_props.find(PROP);
+
+    if (it == m_props.end()) {
+        it = m_props.emplace(PROP, CCompressedBitmap{}).first;
+        m_propTrie.insert(PROP, &it->second);
+    }
+
+    it->second.set(slotOf(id));
+}
+
+void CBusIndex::removeProperty(uint32_t id, uint32_t key, const std::string_view& value) {
+    m_epoch++;
+
+    const auto PROP = std::format("{}={}", g_atoms->str(key), value);
+    auto       it   = m_props.find(PROP);
+
+    if (it == m_props.end())
+        return;
+
+    it->second.clear(slotOf(id));
+
+    if (!it->second.empty())
+        return;
+
+    m_propTrie.erase(PROP);
+    m_props.erase(it);
+}
+
+uint64_t CBusIndex::epoch() const {
+    return m_epoch;
+}
+
+bool CBusIndex::seesAll(const SPermissionSet& grants) {
+    return grants.has(HP_HYPRTAVERN_CORE_V1_SECURITY_PERMISSION_TYPE_MONITORING_ALL_BUS_OBJECTS);
+}
+
+void CBusIndex::hideFrom(CBitmap& bitmap, const SProtocolEntry& entry, const SPermissionSet& grants) {
+    if (entry.requiredPerms.empty() || seesAll(grants))
+        return;
+
+    for (const auto& [slot, perms] : entry.requiredPerms) {
+        if (!grants.hasAll(perms))
+            bitmap.clear(slot);
+    }
+}
+
+bool CBusIndex::restricted() const {
+    return m_restrictedProtocols > 0;
+}
+
+bool CBusIndex::protocolVisibleTo(uint32_t id, uint32_t name, const SPermissionSet& grants) const {
+    if (!m_restrictedProtocols || seesAll(grants))
+        return true;
+
+    auto it = m_protocols.find(name);
+    if (it == m_protocols.end())
+        return true;
+
+    auto perms = it->second.requiredPerms.find(slotOf(id));
+    return perms == it->second.requiredPerms.end() || grants.hasAll(perms->second);
+}
+
+bool CBusIndex::visibleTo(uint32_t id, const SPermissionSet& grants) const {
+    if (!m_restrictedProtocols || seesAll(grants))
+        return true;
+
+    const auto SLOT = slotOf(id);
+    if (SLOT >= m_slotProtocols.size() || m_slotProtocols[SLOT].empty())
+        return true;
+
+    return std::ranges::any_of(m_slotProtocols[SLOT], [this, id, &grants](uint32_t name) { return protocolVisibleTo(id, name, grants); });
+}
+
+void CBusIndex::filterVisible(std::vector<uint32_t>& ids, const SPermissionSet& grants) const {
+    if (!m_restrictedProtocols || seesAll(grants))
+        return;
+
+    std::erase_if(ids, [this, &grants](uint32_t id) { return !visibleTo(id, grants); });
+}
+
+const CBitmap& CBusIndex::allObjects() const {
+    return m_all;
+}
+
+bool CBusIndex::hasProtocol(uint32_t name) const {
+    return m_protocols.contains(name);
+}
+
+CBitmap CBusIndex::objectsWithProtocol(uint32_t name, const SPermissionSet& grants) const {
+    auto it = m_protocols.find(name);
+    if (it == m_protocols.end())
+        return {};
+
+    auto result = it->second.objects.toBitmap();
+    hideFrom(result, it->second, grants);
+    return result;
+}
+
+CBitmap CBusIndex::objectsWithProperty(const std::string_view& prop) const {
+    auto it = m_props.find(prop);
+    if (it == m_props.end())
+        return {};
+
+    return it->second.toBitmap();
+}
+
+CBitmap CBusIndex::objectsWithProtocolPrefix(const std::string_view& prefix, const SPermissionSet& grants) const {
+    CBitmap result;
+
+    m_protocolTrie.forEachWithPrefix(prefix, [&result, &grants](const SProtocolEntry* e) {
+        if (e->requiredPerms.empty() || seesAll(grants)) {
+            e->objects.orInto(result);
+            return;
+        }
+
+        auto visible = e->objects.toBitmap();
+        hideFrom(visible, *e, grants);
+        result |= visible;
+    });
+
+    return result;
+}
+
+CBitmap CBusIndex::objectsWithPropertyPrefix(const std::string_view& prefix) const {
+    CBitmap result;
+    m_propTrie.forEachWithPrefix(prefix, [&result](const CCompressedBitmap* e) { e->orInto(result); });
+    return result;
+}
+
+std::vector<uint32_t> CBusIndex::idsOf(const CBitmap& bitmap) const {
+    std::vector<uint32_t> ids;
+    ids.reserve(bitmap.count());
+
+    bitmap.forEach([this, &ids](uint32_t slot) {
+        if (slot < m_slotIds.size() && m_slotIds[slot])
+            ids.emplace_back(m_slotIds[slot]);
+    });
+
+    return ids;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include <hp_hyprtavern_core_v1-server.hpp>
+
+#include "../helpers/Hash.hpp"
+#include "../helpers/Trie.hpp"
+#include "../helpers/Bitmap.hpp"
+#include "../helpers/PermissionSet.hpp"
+
+class CBusObject;
+
+struct SQueryData {
+    std::vector<std::string>             protocolNames;
+    hpHyprtavernCoreV1BusQueryFilterMode protoFilter = HP_HYPRTAVERN_CORE_V1_BUS_QUERY_FILTER_MODE_ALL;
+    std::vector<std::string>             props;
+    hpHyprtavernCoreV1BusQueryFilterMode propFilter = HP_HYPRTAVERN_CORE_V1_BUS_QUERY_FILTER_MODE_ALL;
+};
+
+// Reverse indexes over the bus registry, kept in sync by CBusObject and CCoreProtocolHandler.
+// Object sets are bitmaps over registry slots, so queries are evaluated with word-wide bit operations.
+class CBusIndex {
+  public:
+    CBusIndex()  = default;
+    ~CBusIndex() = default;
+
+    CBusIndex(const CBusIndex&) = delete;
+    CBusIndex(CBusIndex&)       = delete;
+    CBusIndex(CBusIndex&&)      = delete;
+
+    void           addObject(uint32_t id);
+    void           removeObject(const CBusObject& obj);
+    // protocol names and property keys are atoms, see g_atoms. perms are needed to see the object has the protocol,
+    // exposing the same protocol again replaces them
+    void           addProtocol(uint32_t id, uint32_t name, const SPermissionSet& perms);
+    void           addProperty(uint32_t id, uint32_t key, const std::string_view& value);
+    void           removeProperty(uint32_t id, uint32_t key, const std::string_view& value);
+
+    const CBitmap& allObjects() const;
+    // regardless of perms, for exclusive claims
+    bool           hasProtocol(uint32_t name) const;
+    // leaves out objects whose protocol grants don't cover
+    CBitmap        objectsWithProtocol(uint32_t name, const SPermissionSet& grants) const;
+
+    // prop is in the "key=value" form
+    CBitmap objectsWithProperty(const std::string_view& prop) const;
+
+    // one trie walk each. The property prefix is matched against "key=value"
+    CBitmap               objectsWithProtocolPrefix(const std::string_view& prefix, const SPermissionSet& grants) const;
+    CBitmap               objectsWithPropertyPrefix(const std::string_view& prefix) const;
+
+    std::vector<uint32_t> idsOf(const CBitmap& bitmap) const;
+    static uint32_t       slotOf(uint32_t id);
+
+    // bumped on every mutation, anything derived from the index is stale once this changes
+    uint64_t epoch() const;
+
+    // Perms are checked per protocol. An object is visible with at least one protocol grants cover, or none at all,
+    // and its other protocols are hidden. MONITORING_ALL_BUS_OBJECTS sees everything.
+    // restricted: whether any protocol on the bus requires perms, nothing is hidden from anyone otherwise
+    bool restricted() const;
+    bool protocolVisibleTo(uint32_t id, uint32_t name, const SPermissionSet& grants) const;
+    bool visibleTo(uint32_t id, const SPermissionSet& grants) const;
+    void filterVisible(std::vector<uint32_t>& ids, const SPermissionSet& grants) const;
+
+  private:
+    struct SProtocolEntry {
+        CCompressedBitmap objects;
+
+        // by slot, only for objects whose exposure requires perms
+        std::unordered_map<uint32_t, SPermissionSet> requiredPerms;
+    };
+
+    static bool seesAll(const SPermissionSet& grants);
+    static void hideFrom(CBitmap& bitmap, const SProtocolEntry& entry, const SPermissionSet& grants);
+
+    std::vector<uint32_t>                        m_slotIds;
+    CBitmap                                      m_all;
+    uint64_t                                     m_epoch = 0;
+
+    std::unordered_map<uint32_t, SProtocolEntry> m_protocols;
+    CPrefixTrie<const SProtocolEntry*>           m_protocolTrie;
+
+    // keyed by "key=value", which is unambiguous as keys can't contain a '='
+    std::unordered_map<std::string, CCompressedBitmap, SStringHash, std::equal_to<>> m_props;
+    CPrefixTrie<const CCompressedBitmap*>                                            m_propTrie;
+
+    // protocol names by slot, and how many requiredPerms entries there are. Nothing to filter while there are none
+    std::vector<std::vector<uint32_t>> m_slotProtocols;
+    size_t                             m_restrictedProtocols = 0;
+};
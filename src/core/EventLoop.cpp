@@ -0,0 +1,209 @@
+#include "EventLoop.hpp"
+
+#include "../helpers/Logger.hpp"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <signal.h>
+#include <unistd.h>
+
+constexpr const int MAX_EVENTS = 32;
+
+CEventLoopTimer::CEventLoopTimer(std::function<void()>&& callback) : m_callback(std::move(callback)) {
+    m_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+CEventLoopTimer::~CEventLoopTimer() {
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+void CEventLoopTimer::arm(int ms, bool repeat) {
+    itimerspec spec = {};
+
+    if (ms >= 0) {
+        // a zeroed it_value would disarm
+        spec.it_value = timespec{.tv_sec = ms / 1000, .tv_nsec = std::max(ms % 1000 * 1000000L, ms ? 0L : 1L)};
+        if (repeat)
+            spec.it_interval = spec.it_value;
+    }
+
+    timerfd_settime(m_fd, 0, &spec, nullptr);
+}
+
+CEventLoopWakeup::CEventLoopWakeup(std::function<void()>&& callback) : m_callback(std::move(callback)) {
+    m_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+CEventLoopWakeup::~CEventLoopWakeup() {
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+void CEventLoopWakeup::signal() {
+    const uint64_t ONE = 1;
+    write(m_fd, &ONE, sizeof(ONE));
+}
+
+CEventLoop::CEventLoop() {
+    m_epollFD = epoll_create1(EPOLL_CLOEXEC);
+
+    if (m_epollFD < 0) {
+        g_logger->log(LOG_ERR, "failed to create an epoll instance");
+        return;
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+
+    if (sigprocmask(SIG_BLOCK, &mask, nullptr) < 0 || (m_signalFD = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+        g_logger->log(LOG_ERR, "failed to create a signalfd");
+        return;
+    }
+
+    addFD(m_signalFD, [this](uint32_t) {
+        signalfd_siginfo info;
+
+        while (read(m_signalFD, &info, sizeof(info)) == sizeof(info)) {
+            g_logger->log(LOG_DEBUG, "got signal {}, exiting", info.ssi_signo);
+            exit();
+        }
+    });
+}
+
+CEventLoop::~CEventLoop() {
+    m_timers.clear();
+    m_wakeups.clear();
+
+    if (m_signalFD >= 0)
+        close(m_signalFD);
+    if (m_epollFD >= 0)
+        close(m_epollFD);
+}
+
+bool CEventLoop::good() const {
+    return m_epollFD >= 0 && m_signalFD >= 0;
+}
+
+bool CEventLoop::addFD(int fd, FDCallback&& callback) {
+    epoll_event ev = {.events = EPOLLIN, .data = {.fd = fd}};
+
+    if (fd < 0 || epoll_ctl(m_epollFD, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        g_logger->log(LOG_ERR, "failed to add fd {} to the event loop", fd);
+        return false;
+    }
+
+    m_sources[fd] = std::move(callback);
+    return true;
+}
+
+void CEventLoop::removeFD(int fd) {
+    if (!m_sources.erase(fd))
+        return;
+
+    epoll_ctl(m_epollFD, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+WP<CEventLoopTimer> CEventLoop::addTimer(std::function<void()>&& callback) {
+    auto timer = makeShared<CEventLoopTimer>(std::move(callback));
+
+    if (timer->m_fd < 0) {
+        g_logger->log(LOG_ERR, "failed to create a timerfd");
+        return {};
+    }
+
+    WP<CEventLoopTimer> weak = timer;
+
+    if (!addFD(timer->m_fd, [weak](uint32_t) {
+            if (!weak)
+                return;
+
+            // expiration count, we don't care how many were missed
+            uint64_t expirations = 0;
+            if (read(weak->m_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                return;
+
+            weak->m_callback();
+        }))
+        return {};
+
+    m_timers.emplace_back(std::move(timer));
+    return weak;
+}
+
+WP<CEventLoopWakeup> CEventLoop::addWakeup(std::function<void()>&& callback) {
+    auto wakeup = makeShared<CEventLoopWakeup>(std::move(callback));
+
+    if (wakeup->m_fd < 0) {
+        g_logger->log(LOG_ERR, "failed to create an eventfd");
+        return {};
+    }
+
+    WP<CEventLoopWakeup> weak = wakeup;
+
+    if (!addFD(wakeup->m_fd, [weak](uint32_t) {
+            if (!weak)
+                return;
+
+            uint64_t count = 0;
+            if (read(weak->m_fd, &count, sizeof(count)) != sizeof(count))
+                return;
+
+            weak->m_callback();
+        }))
+        return {};
+
+    m_wakeups.emplace_back(std::move(wakeup));
+    return weak;
+}
+
+void CEventLoop::setOnIdle(std::function<void()>&& callback) {
+    m_onIdle = std::move(callback);
+}
+
+void CEventLoop::exit(bool success) {
+    m_exit    = true;
+    m_success = m_success && success;
+}
+
+bool CEventLoop::run() {
+    epoll_event events[MAX_EVENTS];
+
+    if (m_onIdle)
+        m_onIdle();
+
+    while (!m_exit) {
+        const int COUNT = epoll_wait(m_epollFD, events, MAX_EVENTS, -1);
+
+        if (COUNT < 0) {
+            if (errno == EINTR)
+                continue;
+
+            g_logger->log(LOG_ERR, "epoll_wait() failed");
+            return false;
+        }
+
+        for (int i = 0; i < COUNT && !m_exit; ++i) {
+            // a callback earlier in the batch might have removed this one
+            const auto IT = m_sources.find(events[i].data.fd);
+            if (IT == m_sources.end())
+                continue;
+
+            // copied, the callback is free to remove itself
+            const auto CALLBACK = IT->second;
+            CALLBACK(events[i].events);
+        }
+
+        if (m_onIdle && !m_exit)
+            m_onIdle();
+    }
+
+    return m_success;
+}
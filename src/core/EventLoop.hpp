@@ -0,0 +1,85 @@
+#pragma once
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+#include "../helpers/Memory.hpp"
+
+// A timerfd, ready when it expires
+class CEventLoopTimer {
+  public:
+    CEventLoopTimer(std::function<void()>&& callback);
+    ~CEventLoopTimer();
+
+    CEventLoopTimer(const CEventLoopTimer&) = delete;
+    CEventLoopTimer(CEventLoopTimer&)       = delete;
+    CEventLoopTimer(CEventLoopTimer&&)      = delete;
+
+    // fires after ms, and every ms after that if repeat is set. ms < 0 disarms, re-arming replaces what was set
+    void                  arm(int ms, bool repeat = false);
+
+    int                   m_fd = -1;
+    std::function<void()> m_callback;
+};
+
+// An eventfd, for waking the loop up from other threads
+class CEventLoopWakeup {
+  public:
+    CEventLoopWakeup(std::function<void()>&& callback);
+    ~CEventLoopWakeup();
+
+    CEventLoopWakeup(const CEventLoopWakeup&) = delete;
+    CEventLoopWakeup(CEventLoopWakeup&)       = delete;
+    CEventLoopWakeup(CEventLoopWakeup&&)      = delete;
+
+    // safe from any thread. Signals before the loop gets to it are coalesced into one callback
+    void                  signal();
+
+    int                   m_fd = -1;
+    std::function<void()> m_callback;
+};
+
+// epoll reactor for the main thread. Sockets, timers, wakeups and SIGTERM / SIGINT (through a signalfd) each get their
+// own epoll entry, so a wakeup only ever touches what is ready, no matter how many sources there are.
+class CEventLoop {
+  public:
+    // blocks SIGTERM and SIGINT for the whole process, construct before any threads are started
+    CEventLoop();
+    ~CEventLoop();
+
+    CEventLoop(const CEventLoop&) = delete;
+    CEventLoop(CEventLoop&)       = delete;
+    CEventLoop(CEventLoop&&)      = delete;
+
+    bool good() const;
+
+    // events are EPOLL* flags. An fd has to be removed before it's closed
+    using FDCallback = std::function<void(uint32_t events)>;
+    bool                 addFD(int fd, FDCallback&& callback);
+    void                 removeFD(int fd);
+
+    // owned by the loop
+    WP<CEventLoopTimer>  addTimer(std::function<void()>&& callback);
+    WP<CEventLoopWakeup> addWakeup(std::function<void()>&& callback);
+
+    // called after every batch of events
+    void setOnIdle(std::function<void()>&& callback);
+
+    // until exit() or a signal. Returns success as given to exit(), false if the loop itself failed
+    bool run();
+    void exit(bool success = true);
+
+  private:
+    int                                 m_epollFD  = -1;
+    int                                 m_signalFD = -1;
+
+    bool                                m_exit    = false;
+    bool                                m_success = true;
+
+    std::unordered_map<int, FDCallback> m_sources;
+    std::vector<SP<CEventLoopTimer>>    m_timers;
+    std::vector<SP<CEventLoopWakeup>>   m_wakeups;
+    std::function<void()>               m_onIdle;
+};
@@ -0,0 +1,175 @@
+#include "PermissionPolicy.hpp"
+
+#include <hp_hyprtavern_core_v1-server.hpp>
+#include <hyprlang.hpp>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <format>
+#include <ranges>
+
+constexpr const std::array<std::pair<std::string_view, uint32_t>, 2> PERMISSION_NAMES = {{
+    {"management_environment", HP_HYPRTAVERN_CORE_V1_SECURITY_PERMISSION_TYPE_MANAGEMENT_ENVIRONMENT},
+    {"monitoring_all_bus_objects", HP_HYPRTAVERN_CORE_V1_SECURITY_PERMISSION_TYPE_MONITORING_ALL_BUS_OBJECTS},
+}};
+
+//
+static SPermissionSet allPermissions() {
+    // everything but the tavernkeep's own
+    SPermissionSet tavernkeep;
+    tavernkeep.add(HP_HYPRTAVERN_CORE_V1_SECURITY_PERMISSION_TYPE_TAVERNKEEP);
+
+    return SPermissionSet{.bits = ~tavernkeep.bits};
+}
+
+static std::string_view trim(const std::string_view& sv) {
+    const auto BEGIN = sv.find_first_not_of(" \t");
+    if (BEGIN == std::string_view::npos)
+        return {};
+
+    return sv.substr(BEGIN, sv.find_last_not_of(" \t") - BEGIN + 1);
+}
+
+// "name, name, 3" or "*"
+static std::expected<SPermissionSet, std::string> parsePermissions(const std::string_view& list) {
+    SPermissionSet set;
+
+    for (const auto& part : std::views::split(list, ',')) {
+        const auto PERM = trim(std::string_view{part.begin(), part.end()});
+
+        if (PERM.empty())
+            continue;
+
+        if (PERM == "*") {
+            set = set | allPermissions();
+            continue;
+        }
+
+        uint32_t type = 0;
+
+        if (const auto IT = std::ranges::find(PERMISSION_NAMES, PERM, [](const auto& e) { return e.first; }); IT != PERMISSION_NAMES.end())
+            type = IT->second;
+        else if (const auto [ptr, ec] = std::from_chars(PERM.data(), PERM.data() + PERM.size(), type); ec != std::errc{} || ptr != PERM.data() + PERM.size())
+            return std::unexpected(std::format("unknown permission \"{}\"", PERM));
+
+        if (type == HP_HYPRTAVERN_CORE_V1_SECURITY_PERMISSION_TYPE_TAVERNKEEP)
+            return std::unexpected("the tavernkeep permission can't be granted by policy");
+
+        if (!set.add(type))
+            return std::unexpected(std::format("permission {} is out of range", type));
+    }
+
+    return set;
+}
+
+CPermissionPolicy CPermissionPolicy::permissive() {
+    CPermissionPolicy policy;
+    policy.m_default.allow          = allPermissions();
+    policy.m_default.allowPermanent = allPermissions();
+
+    return policy;
+}
+
+std::expected<CPermissionPolicy, std::string> CPermissionPolicy::compile(const std::string& path) {
+    Hyprlang::CConfig config(path.c_str(), Hyprlang::SConfigOptions{});
+
+    // a policy file that doesn't say anything grants nothing
+    config.addConfigValue("general:default_allow", Hyprlang::STRING{""});
+    config.addConfigValue("general:default_allow_permanent", Hyprlang::STRING{""});
+
+    config.addSpecialCategory("app", Hyprlang::SSpecialCategoryOptions{.key = nullptr, .anonymousKeyBased = true});
+    config.addSpecialConfigValue("app", "binary", Hyprlang::STRING{""});
+    config.addSpecialConfigValue("app", "name", Hyprlang::STRING{""});
+    config.addSpecialConfigValue("app", "allow", Hyprlang::STRING{""});
+    config.addSpecialConfigValue("app", "allow_permanent", Hyprlang::STRING{""});
+
+    config.commence();
+
+    if (const auto RESULT = config.parse(); RESULT.error)
+        return std::unexpected(std::format("failed to parse: {}", RESULT.getError()));
+
+    // permanent grants are grants too
+    const auto compileRule = [](const char* allow, const char* allowPermanent) -> std::expected<SRule, std::string> {
+        const auto ALLOW           = parsePermissions(allow);
+        const auto ALLOW_PERMANENT = parsePermissions(allowPermanent);
+
+        if (!ALLOW)
+            return std::unexpected(ALLOW.error());
+        if (!ALLOW_PERMANENT)
+            return std::unexpected(ALLOW_PERMANENT.error());
+
+        return SRule{.allow = *ALLOW | *ALLOW_PERMANENT, .allowPermanent = *ALLOW_PERMANENT};
+    };
+
+    CPermissionPolicy policy;
+
+    const auto        DEFAULT_RULE = compileRule(std::any_cast<Hyprlang::STRING>(config.getConfigValue("general:default_allow")),
+                                                 std::any_cast<Hyprlang::STRING>(config.getConfigValue("general:default_allow_permanent")));
+
+    if (!DEFAULT_RULE)
+        return std::unexpected(std::format("general: {}", DEFAULT_RULE.error()));
+
+    policy.m_default = *DEFAULT_RULE;
+
+    for (const auto& key : config.listKeysForSpecialCategory("app")) {
+        const std::string_view BINARY = std::any_cast<Hyprlang::STRING>(config.getSpecialConfigValue("app", "binary", key.c_str()));
+        const std::string_view NAME   = std::any_cast<Hyprlang::STRING>(config.getSpecialConfigValue("app", "name", key.c_str()));
+
+        if (BINARY.empty() && NAME.empty())
+            return std::unexpected("app rule without a binary or a name");
+
+        auto rule = compileRule(std::any_cast<Hyprlang::STRING>(config.getSpecialConfigValue("app", "allow", key.c_str())),
+                                std::any_cast<Hyprlang::STRING>(config.getSpecialConfigValue("app", "allow_permanent", key.c_str())));
+
+        if (!rule)
+            return std::unexpected(std::format("app {}: {}", BINARY.empty() ? NAME : BINARY, rule.error()));
+
+        // with both, the binary decides and the name has to match as well
+        rule->name = NAME;
+
+        auto& table         = BINARY.empty() ? policy.m_byName : policy.m_byBinary;
+        auto [it, inserted] = table.try_emplace(std::string{BINARY.empty() ? NAME : BINARY}, std::move(*rule));
+
+        if (!inserted)
+            return std::unexpected(std::format("duplicate rule for app {}", it->first));
+    }
+
+    return policy;
+}
+
+const CPermissionPolicy::SRule& CPermissionPolicy::ruleFor(const std::string_view& binary, const std::string_view& name) const {
+    // the name is whatever the app says it is. Once the binary is known, a name rule could only be used to escape its rule,
+    // so it only narrows it, in allows()
+    if (!binary.empty()) {
+        if (auto it = m_byBinary.find(binary); it != m_byBinary.end() && (it->second.name.empty() || it->second.name == name))
+            return it->second;
+
+        return m_default;
+    }
+
+    if (auto it = m_byName.find(name); it != m_byName.end())
+        return it->second;
+
+    return m_default;
+}
+
+bool CPermissionPolicy::allows(const std::string_view& binary, const std::string_view& name, uint32_t type, uint32_t mode) const {
+    const auto ruleAllows = [type, mode](const SRule& rule) {
+        if (mode == HP_HYPRTAVERN_CORE_V1_SECURITY_PERMISSION_MODE_PERMANENT)
+            return rule.allowPermanent.has(type);
+
+        return rule.allow.has(type);
+    };
+
+    if (!ruleAllows(ruleFor(binary, name)))
+        return false;
+
+    // a name rule has to allow it too, whatever the binary's rule says
+    if (!binary.empty()) {
+        if (auto it = m_byName.find(name); it != m_byName.end())
+            return ruleAllows(it->second);
+    }
+
+    return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <expected>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <cstdint>
+
+#include "../helpers/Hash.hpp"
+#include "../helpers/PermissionSet.hpp"
+
+// Which permissions apps get when they ask, from a hyprlang policy file:
+//
+// general {
+//     default_allow = management_environment    # apps without a rule, "*" for everything. Nothing if unset
+//     default_allow_permanent =
+// }
+//
+// app {
+//     binary = /usr/bin/hyprtavern-env    # and / or
+//     name = hyprtavern-env               # what the app set as its identity
+//     allow = management_environment, monitoring_all_bus_objects
+//     allow_permanent = management_environment
+// }
+//
+// An app with a known binary gets its binary rule, or the default if there's none or its name doesn't match the rule's.
+// The binary is read from /proc, so it's known for about every app. The name is whatever the app says it is, so a rule
+// with just a name can only take permissions away from those, and only decides on its own when the binary is unknown.
+// Rules are compiled into hash tables keyed by binary and name, a decision is two lookups and two bit tests at most.
+class CPermissionPolicy {
+  public:
+    CPermissionPolicy()  = default;
+    ~CPermissionPolicy() = default;
+
+    // allows everything, which is what happens without a policy file
+    static CPermissionPolicy                             permissive();
+
+    static std::expected<CPermissionPolicy, std::string> compile(const std::string& path);
+
+    // binary may be empty if it's unknown. mode is a hpHyprtavernCoreV1SecurityPermissionMode
+    bool allows(const std::string_view& binary, const std::string_view& name, uint32_t type, uint32_t mode) const;
+
+  private:
+    struct SRule {
+        SPermissionSet allow, allowPermanent;
+        std::string    name; // rules by binary can require a name too
+    };
+
+    const SRule&                                                         ruleFor(const std::string_view& binary, const std::string_view& name) const;
+
+    std::unordered_map<std::string, SRule, SStringHash, std::equal_to<>> m_byBinary, m_byName;
+    SRule                                                                m_default;
+};
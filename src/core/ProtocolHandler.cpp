@@ -2,30 +2,31 @@
 #include "../helpers/Logger.hpp"
 
 #include <algorithm>
+#include <filesystem>
 #include <format>
-#include <random>
-#include <limits>
 
 #include <sys/socket.h>
 #include <sys/poll.h>
-#include <uuid.h>
 #include <glaze/glaze.hpp>
 
-constexpr const uint32_t                   TAVERN_PROTOCOL_VERSION = 1;
-constexpr const uint32_t                   KV_PROTOCOL_VERSION     = 1;
-constexpr const uint32_t                   MAID_PROTOCOL_VERSION   = 1;
-
-static SP<CCHpHyprtavernCoreV1Impl>        clientCoreImpl    = makeShared<CCHpHyprtavernCoreV1Impl>(TAVERN_PROTOCOL_VERSION);
-static SP<CCHpHyprtavernKvStoreV1Impl>     clientKvImpl      = makeShared<CCHpHyprtavernKvStoreV1Impl>(KV_PROTOCOL_VERSION);
-static SP<CCHpHyprtavernBarmaidV1Impl>     clientBarmaidImpl = makeShared<CCHpHyprtavernBarmaidV1Impl>(MAID_PROTOCOL_VERSION);
 static SP<CHpHyprtavernCoreV1Impl>         coreImpl;
-static uint32_t                            maxId = 1;
 
 constexpr const std::array<const char*, 2> ENV_FREE_TO_UPDATE = {"WAYLAND_DISPLAY", "DISPLAY"};
 
+// unredeemed one-time tokens are expired with this granularity
+constexpr const std::chrono::milliseconds ONE_TIME_TOKEN_TICK = std::chrono::milliseconds(100);
+constexpr const std::chrono::seconds      ONE_TIME_TOKEN_TTL  = std::chrono::seconds(30);
+
 //
+static SPermissionSet requiredPermissions(const std::vector<uint32_t>& perms) {
+    // a requirement no regular client could ever meet, only the tavernkeep and monitors get to see it
+    if (std::ranges::any_of(perms, [](uint32_t p) { return p >= SPermissionSet::MAX; }))
+        return SPermissionSet{.bits = UINT64_MAX};
+
+    return SPermissionSet::fromVector(perms);
+}
 
-CBusQuery::CBusQuery(SP<CHpHyprtavernBusQueryV1Object>&& obj, SQueryData&& data) : m_data(std::move(data)), m_object(std::move(obj)) {
+CBusQuery::CBusQuery(SP<CHpHyprtavernBusQueryV1Object>&& obj, SQueryData&& data, const SPermissionSet& grants) : m_data(std::move(data)), m_object(std::move(obj)) {
     if (!m_object->getObject())
         return;
 
@@ -34,89 +35,27 @@ CBusQuery::CBusQuery(SP<CHpHyprtavernBusQueryV1Object>&& obj, SQueryData&& data)
 
     g_logger->log(LOG_DEBUG, "new query with {} protocols and {} props", m_data.protocolNames.size(), m_data.props.size());
 
-    // run the query
-    std::vector<uint32_t> matches;
-    for (const auto& obj : g_coreProto->m_objects) {
-
-        // protocols
-        if (!m_data.protocolNames.empty()) {
-            if (m_data.protoFilter == HP_HYPRTAVERN_CORE_V1_BUS_QUERY_FILTER_MODE_ALL) {
-                bool matched = true;
-                for (const auto& p : m_data.protocolNames) {
-                    if (std::ranges::find_if(obj->m_protocols, [&p](const auto& e) { return e.name == p; }) != obj->m_protocols.end())
-                        continue;
-
-                    matched = false;
-                    break;
-                }
-
-                if (!matched)
-                    continue;
-            } else {
-                bool matched = false;
-                for (const auto& p : m_data.protocolNames) {
-                    if (std::ranges::find_if(obj->m_protocols, [&p](const auto& e) { return e.name == p; }) == obj->m_protocols.end())
-                        continue;
-
-                    matched = true;
-                    break;
-                }
-
-                if (!matched)
-                    continue;
-            }
-        }
+    auto plan = CQueryPlan::compile(m_data);
 
-        // properties
-        if (!m_data.props.empty()) {
-            if (m_data.propFilter == HP_HYPRTAVERN_CORE_V1_BUS_QUERY_FILTER_MODE_ALL) {
-                bool matched = true;
-                for (const auto& p : m_data.props) {
-                    if (!p.contains('=')) {
-                        m_object->error(HP_HYPRTAVERN_CORE_V1_BUS_OBJECT_ERRORS_INVALID_PROPERTY_NAME, "Invalid property in query");
-                        return;
-                    }
-                    size_t           eqPos    = p.find('=');
-                    std::string_view propName = std::string_view(p).substr(0, eqPos);
-                    std::string_view propVal  = std::string_view(p).substr(eqPos + 1);
-
-                    if (std::ranges::find_if(obj->m_props, [&propName, &propVal](const auto& e) { return e.first == propName && e.second == propVal; }) != obj->m_props.end())
-                        continue;
-
-                    matched = false;
-                    break;
-                }
-
-                if (!matched)
-                    continue;
-            } else {
-                bool matched = false;
-                for (const auto& p : m_data.props) {
-                    if (!p.contains('=')) {
-                        m_object->error(HP_HYPRTAVERN_CORE_V1_BUS_OBJECT_ERRORS_INVALID_PROPERTY_NAME, "Invalid property in query");
-                        return;
-                    }
-                    size_t           eqPos    = p.find('=');
-                    std::string_view propName = std::string_view(p).substr(0, eqPos);
-                    std::string_view propVal  = std::string_view(p).substr(eqPos + 1);
-
-                    if (std::ranges::find_if(obj->m_props, [&propName, &propVal](const auto& e) { return e.first == propName && e.second == propVal; }) == obj->m_props.end())
-                        continue;
-
-                    matched = true;
-                    break;
-                }
-
-                if (!matched)
-                    continue;
-            }
-        }
+    if (!plan) {
+        m_object->error(HP_HYPRTAVERN_CORE_V1_BUS_OBJECT_ERRORS_INVALID_PROPERTY_NAME, plan.error().c_str());
+        return;
+    }
+
+    // identical queries between registry mutations are answered from the cache
+    auto                  key   = CQueryCache::keyFor(m_data, g_coreProto->m_index.restricted() ? grants : SPermissionSet{});
+    const auto            EPOCH = g_coreProto->m_index.epoch();
+    std::vector<uint32_t> matches;
 
-        // matched
-        matches.emplace_back(obj->m_internalID);
+    if (const auto CACHED = g_coreProto->m_queryCache.get(key, EPOCH); CACHED)
+        matches = *CACHED;
+    else {
+        matches = plan->run(g_coreProto->m_index, grants);
+        g_coreProto->m_queryCache.put(std::move(key), EPOCH, matches);
     }
 
-    g_logger->log(LOG_DEBUG, "query got {} matches", matches.size());
+    g_logger->log(LOG_DEBUG, "query got {} matches (cache: {} hits, {} misses)", matches.size(), g_coreProto->m_queryCache.stats().hits,
+                  g_coreProto->m_queryCache.stats().misses);
 
     // send the matches
     m_object->sendResults(matches);
@@ -126,31 +65,34 @@ CBusObject::CBusObject(SP<CHpHyprtavernBusObjectV1Object>&& obj, const char* nam
     if (!m_object->getObject())
         return;
 
-    m_internalID = maxId++;
-
-    g_logger->log(LOG_DEBUG, "new bus object gets id {}", m_internalID);
-
     m_object->setOnDestroy([this]() { g_coreProto->removeObject(this); });
     m_object->setDestroy([this]() { g_coreProto->removeObject(this); });
 
     m_object->setExposeProtocol([this](const char* name, uint32_t rev, const std::vector<uint32_t>& requiredPerms, uint32_t exclusiveMode) {
+        // held by the m_protocols entry, released in CCoreProtocolHandler::removeObject
+        const auto ATOM  = g_atoms->intern(name);
+        const auto PERMS = requiredPermissions(requiredPerms);
+
         if (!exclusiveMode) {
-            m_protocols.emplace_back(SProtocolExposeData{.name = name, .rev = rev, .perms = requiredPerms});
+            m_protocols.emplace_back(SProtocolExposeData{.name = ATOM, .rev = rev, .perms = PERMS});
+            m_descriptorDirty = true;
+            g_coreProto->m_index.addProtocol(m_internalID, ATOM, PERMS);
             return;
         }
 
         // exclusive mode: check if this protocol is not already on the bus.
-        for (const auto& o : g_coreProto->m_objects) {
-            const bool HAS = std::ranges::any_of(o->m_protocols, [&name](const auto& e) { return e.name == name; });
-            if (HAS) {
-                // send an error, already taken, ignore this request
-                m_object->sendExposeProtocolError(HP_HYPRTAVERN_CORE_V1_BUS_OBJECT_EXPOSE_ERRORS_ALREADY_EXPOSED);
-                return;
-            }
+        if (g_coreProto->m_index.hasProtocol(ATOM)) {
+            g_atoms->release(ATOM);
+
+            // send an error, already taken, ignore this request
+            m_object->sendExposeProtocolError(HP_HYPRTAVERN_CORE_V1_BUS_OBJECT_EXPOSE_ERRORS_ALREADY_EXPOSED);
+            return;
         }
 
         // pass: register
-        m_protocols.emplace_back(SProtocolExposeData{.name = name, .rev = rev, .perms = requiredPerms});
+        m_protocols.emplace_back(SProtocolExposeData{.name = ATOM, .rev = rev, .perms = PERMS});
+        m_descriptorDirty = true;
+        g_coreProto->m_index.addProtocol(m_internalID, ATOM, PERMS);
     });
 
     m_object->setExposeProperty([this](const char* n, const char* v) {
@@ -174,11 +116,37 @@ CBusObject::CBusObject(SP<CHpHyprtavernBusObjectV1Object>&& obj, const char* nam
         }
 
         if (value.empty()) {
-            std::erase_if(m_props, [&name](const auto& e) { return e.first == name; });
+            auto it = m_props.find(g_atoms->find(name));
+            if (it == m_props.end())
+                return;
+
+            const auto KEY = it->first;
+
+            g_coreProto->m_index.removeProperty(m_internalID, KEY, it->second);
+            m_props.erase(it);
+            m_descriptorDirty = true;
+
+            g_atoms->release(KEY);
             return;
         }
 
-        m_props.emplace_back(std::make_pair<>(name, value));
+        auto it = m_props.find(g_atoms->find(name));
+
+        if (it != m_props.end()) {
+            if (it->second == value)
+                return;
+
+            // replace the old value
+            g_coreProto->m_index.removeProperty(m_internalID, it->first, it->second);
+            it->second = value;
+        } else {
+            // a new key holds its atom until the prop is removed again
+            it = m_props.emplace(g_atoms->intern(name), value).first;
+        }
+
+        m_descriptorDirty = true;
+
+        g_coreProto->m_index.addProperty(m_internalID, it->first, it->second);
     });
 }
 
@@ -186,17 +154,48 @@ void CBusObject::sendNewConnection(int fd, const std::string& token) {
     m_object->sendNewFd(fd, token.c_str());
 }
 
-CBusObjectHandle::CBusObjectHandle(SP<CHpHyprtavernBusObjectHandleV1Object>&& obj, SP<CBusObject> busObject) : m_busObject(busObject), m_object(std::move(obj)) {
+const CBusObject::SDescriptor& CBusObject::descriptor() {
+    if (!m_descriptorDirty)
+        return m_descriptor;
+
+    m_descriptorDirty = false;
+
+    m_descriptor.protocolNames.clear();
+    m_descriptor.protocolRevs.clear();
+    m_descriptor.props.clear();
+    m_descriptor.propStrs.clear();
+
+    for (const auto& p : m_protocols) {
+        // atom strings never move, and we hold their atoms, so these can be kept around
+        m_descriptor.protocolNames.emplace_back(g_atoms->str(p.name).c_str());
+        m_descriptor.protocolRevs.emplace_back(p.rev);
+    }
+
+    m_descriptor.props.reserve(m_props.size());
+
+    for (const auto& [n, v] : m_props) {
+        m_descriptor.props.emplace_back(std::format("{}={}", g_atoms->str(n), v));
+    }
+
+    // only take pointers once the strings are in place
+    m_descriptor.propStrs.reserve(m_descriptor.props.size());
+    for (const auto& p : m_descriptor.props) {
+        m_descriptor.propStrs.emplace_back(p.c_str());
+    }
+
+    return m_descriptor;
+}
+
+CBusObjectHandle::CBusObjectHandle(SP<CHpHyprtavernBusObjectHandleV1Object>&& obj, SP<CBusObject> busObject, SP<CCoreManagerObject> manager) :
+    m_busObject(busObject), m_manager(manager), m_object(std::move(obj)) {
     if (!m_object->getObject())
         return;
 
-    // FIXME: perms!!!!
-
     m_object->setOnDestroy([this]() { g_coreProto->removeObject(this); });
     m_object->setDestroy([this]() { g_coreProto->removeObject(this); });
 
     m_object->setConnect([this]() {
-        if (!m_busObject) {
+        if (!m_busObject || !visible()) {
             m_object->sendSocketFailed();
             return;
         }
@@ -213,18 +212,17 @@ CBusObjectHandle::CBusObjectHandle(SP<CHpHyprtavernBusObjectHandleV1Object>&& ob
 
         if (m_manager->m_associatedSecurityToken.empty())
             m_busObject->sendNewConnection(fds[1], "");
-        else {
-            // FIXME: small leak. Clean up uuids after object is gone?
-            auto uuid                            = g_coreProto->generateToken();
-            g_coreProto->m_oneTimeTokenMap[uuid] = m_manager->m_associatedSecurityToken;
-            m_busObject->sendNewConnection(fds[1], uuid);
-        }
+        else
+            m_busObject->sendNewConnection(fds[1], g_coreProto->issueOneTimeToken(m_manager.lock(), m_busObject.lock()).toString());
 
         close(fds[0]);
         close(fds[1]);
     });
 
-    // send the data about the object
+    // send the data about the object. One the manager can't see doesn't exist as far as it's concerned
+
+    if (m_busObject && !visible())
+        m_busObject.reset();
 
     if (!m_busObject) {
         g_logger->log(LOG_DEBUG, "new object handle for invalid object");
@@ -236,37 +234,42 @@ CBusObjectHandle::CBusObjectHandle(SP<CHpHyprtavernBusObjectHandleV1Object>&& ob
 
     m_object->sendName(m_busObject->m_name.c_str());
 
-    {
-        std::vector<const char*> names;
-        std::vector<uint32_t>    revs;
+    sendDescriptor();
+}
 
-        names.reserve(m_busObject->m_protocols.size());
-        revs.reserve(m_busObject->m_protocols.size());
+bool CBusObjectHandle::visible() const {
+    const auto MANAGER = m_manager.lock();
+    return m_busObject && MANAGER && g_coreProto->m_index.visibleTo(m_busObject->m_internalID, MANAGER->m_grants);
+}
 
-        for (const auto& p : m_busObject->m_protocols) {
-            // FIXME: perms!!!
-            names.emplace_back(p.name.c_str());
-            revs.emplace_back(p.rev);
-        }
+void CBusObjectHandle::sendDescriptor() {
+    if (!m_busObject)
+        return;
 
-        m_object->sendProtocols(names, revs);
-    }
+    const auto& DESCRIPTOR = m_busObject->descriptor();
 
-    {
-        std::vector<std::string> container;
-        std::vector<const char*> strs;
+    if (!g_coreProto->m_index.restricted())
+        m_object->sendProtocols(DESCRIPTOR.protocolNames, DESCRIPTOR.protocolRevs);
+    else {
+        // leave out what the manager isn't allowed to see, descriptor entries are in m_protocols order
+        const auto               MANAGER = m_manager.lock();
+        const auto               GRANTS  = MANAGER ? MANAGER->m_grants : SPermissionSet{};
+        std::vector<const char*> names;
+        std::vector<uint32_t>    revs;
 
-        container.reserve(m_busObject->m_props.size());
-        strs.reserve(m_busObject->m_props.size());
+        for (size_t i = 0; i < m_busObject->m_protocols.size(); ++i) {
+            if (!g_coreProto->m_index.protocolVisibleTo(m_busObject->m_internalID, m_busObject->m_protocols[i].name, GRANTS))
+                continue;
 
-        for (const auto& [n, v] : m_busObject->m_props) {
-            container.emplace_back(std::format("{}={}", n, v));
-            strs.emplace_back(container.back().c_str());
+            names.emplace_back(DESCRIPTOR.protocolNames[i]);
+            revs.emplace_back(DESCRIPTOR.protocolRevs[i]);
         }
 
-        m_object->sendProperties(strs);
+        m_object->sendProtocols(names, revs);
     }
 
+    m_object->sendProperties(DESCRIPTOR.propStrs);
+
     m_object->sendDone();
 }
 
@@ -277,30 +280,55 @@ CCoreManagerObject::CCoreManagerObject(SP<CHpHyprtavernCoreManagerV1Object>&& ob
     m_object->setOnDestroy([this]() { g_coreProto->removeObject(this); });
     m_object->setDestroy([this]() { g_coreProto->removeObject(this); });
 
-    if (m_object->getObject()->client() == g_coreProto->m_client.wireClient)
+    if (m_object->getObject()->client() == g_coreProto->m_client.wireClient) {
         m_associatedSecurityToken = g_coreProto->m_tavernkeepToken;
+        m_grants                  = SPermissionSet{.bits = UINT64_MAX};
+    }
 
+    // the wire objects created below get handlers that capture the new object, which the registry keeps alive.
+    // So a full registry has to be caught before they exist
     m_object->setGetBusObject([this](uint32_t seq, const char* objectName) {
-        g_coreProto->m_objects.emplace_back( //
-            makeShared<CBusObject>(          //
-                makeShared<CHpHyprtavernBusObjectV1Object>(
-                    g_coreProto->m_sock->createObject(m_object->getObject()->client(), m_object->getObject(), "hp_hyprtavern_bus_object_v1", seq)), //
-                objectName                                                                                                                          //
-                ));
+        if (g_coreProto->m_objects.full()) {
+            m_object->error(-1, "bus object registry is full");
+            return;
+        }
+
+        auto x = makeShared<CBusObject>( //
+            makeShared<CHpHyprtavernBusObjectV1Object>(
+                g_coreProto->m_sock->createObject(m_object->getObject()->client(), m_object->getObject(), "hp_hyprtavern_bus_object_v1", seq)), //
+            objectName                                                                                                                          //
+        );
+
+        x->m_internalID = g_coreProto->m_objects.insert(x);
+
+        g_logger->log(LOG_DEBUG, "new bus object gets id {}", x->m_internalID);
+
+        g_coreProto->m_index.addObject(x->m_internalID);
     });
 
     m_object->setGetObjectHandle([this](uint32_t seq, uint32_t id) {
-        auto x       = g_coreProto->m_handles.emplace_back( //
-            makeShared<CBusObjectHandle>(             //
-                makeShared<CHpHyprtavernBusObjectHandleV1Object>(
-                    g_coreProto->m_sock->createObject(m_object->getObject()->client(), m_object->getObject(), "hp_hyprtavern_bus_object_handle_v1", seq)), //
-                g_coreProto->fromID(id)                                                                                                                    //
-                ));
-              x->m_manager = m_self;
+        if (g_coreProto->m_handles.full()) {
+            m_object->error(-1, "object handle registry is full");
+            return;
+        }
+
+        auto x = makeShared<CBusObjectHandle>( //
+            makeShared<CHpHyprtavernBusObjectHandleV1Object>(
+                g_coreProto->m_sock->createObject(m_object->getObject()->client(), m_object->getObject(), "hp_hyprtavern_bus_object_handle_v1", seq)), //
+            g_coreProto->fromID(id),                                                                                                                   //
+            m_self.lock()                                                                                                                              //
+        );
+
+        x->m_id = g_coreProto->m_handles.insert(x);
     });
 
     m_object->setGetQueryObject([this](uint32_t seq, std::vector<const char*> protos, hpHyprtavernCoreV1BusQueryFilterMode protoMode, std::vector<const char*> props,
                                        hpHyprtavernCoreV1BusQueryFilterMode propMode) {
+        if (g_coreProto->m_queries.full()) {
+            m_object->error(-1, "query registry is full");
+            return;
+        }
+
         SQueryData data;
         data.propFilter  = propMode;
         data.protoFilter = protoMode;
@@ -316,12 +344,14 @@ CCoreManagerObject::CCoreManagerObject(SP<CHpHyprtavernCoreManagerV1Object>&& ob
             data.props.emplace_back(pn);
         }
 
-        g_coreProto->m_queries.emplace_back( //
-            makeShared<CBusQuery>(           //
-                makeShared<CHpHyprtavernBusQueryV1Object>(
-                    g_coreProto->m_sock->createObject(m_object->getObject()->client(), m_object->getObject(), "hp_hyprtavern_bus_query_v1", seq)), //
-                std::move(data)                                                                                                                    //
-                ));
+        auto x = makeShared<CBusQuery>( //
+            makeShared<CHpHyprtavernBusQueryV1Object>(
+                g_coreProto->m_sock->createObject(m_object->getObject()->client(), m_object->getObject(), "hp_hyprtavern_bus_query_v1", seq)), //
+            std::move(data),                                                                                                                   //
+            m_grants                                                                                                                           //
+        );
+
+        x->m_id = g_coreProto->m_queries.insert(x);
     });
 
     m_object->setGetSecurityObject([this](uint32_t seq, const char* token) {
@@ -330,15 +360,23 @@ CCoreManagerObject::CCoreManagerObject(SP<CHpHyprtavernCoreManagerV1Object>&& ob
             return;
         }
 
-        auto x = g_coreProto->m_securityObjects.emplace_back( //
-            makeShared<CSecurityObject>(                      //
-                makeShared<CHpHyprtavernSecurityObjectV1Object>(
-                    g_coreProto->m_sock->createObject(m_object->getObject()->client(), m_object->getObject(), "hp_hyprtavern_security_object_v1", seq)), //
-                m_self.lock(),                                                                                                                           //
-                token                                                                                                                                    //
-                ));
+        if (g_coreProto->m_securityObjects.full()) {
+            m_object->error(-1, "security object registry is full");
+            return;
+        }
+
+        auto x = makeShared<CSecurityObject>( //
+            makeShared<CHpHyprtavernSecurityObjectV1Object>(
+                g_coreProto->m_sock->createObject(m_object->getObject()->client(), m_object->getObject(), "hp_hyprtavern_security_object_v1", seq)), //
+            m_self.lock(),                                                                                                                           //
+            token                                                                                                                                    //
+        );
+
+        x->m_id = g_coreProto->m_securityObjects.insert(x);
 
         m_security = x;
+
+        x->resolve();
     });
 
     m_object->setGetSecurityResponse([this](uint32_t seq, const char* token) {
@@ -367,7 +405,7 @@ CCoreManagerObject::CCoreManagerObject(SP<CHpHyprtavernCoreManagerV1Object>&& ob
         g_logger->log(LOG_DEBUG, "updating environment: {} new values", names.size());
 
         // update barmaids
-        g_coreProto->m_client.kvBarmaidManager->sendUpdateTavernEnvironment(names, values);
+        g_coreProto->m_barmaids.updateEnvironment(names, values);
 
         // update ourselves
         for (size_t i = 0; i < names.size(); ++i) {
@@ -383,13 +421,7 @@ bool CCoreManagerObject::hasPerm(hpHyprtavernCoreV1SecurityPermissionType type)
     if (!m_security)
         return false;
 
-    if (std::ranges::contains(m_security->m_sessionPerms, type))
-        return true;
-
-    if (std::ranges::contains(m_security->m_kvData.persistentPerms, type))
-        return true;
-
-    return false;
+    return m_security->m_grants.has(type);
 }
 
 CSecurityObject::CSecurityObject(SP<CHpHyprtavernSecurityObjectV1Object>&& obj, SP<CCoreManagerObject> manager, const std::string& token) :
@@ -400,9 +432,14 @@ CSecurityObject::CSecurityObject(SP<CHpHyprtavernSecurityObjectV1Object>&& obj,
     m_object->setOnDestroy([this]() { g_coreProto->removeObject(this); });
     m_object->setDestroy([this]() { g_coreProto->removeObject(this); });
 
-    if (!g_coreProto->m_client.kvOpen) {
-        m_object->sendUnavailable();
-        return;
+    m_requestedToken = SToken::fromString(token);
+
+    // what the policy knows apps by, next to the name they give themselves
+    m_pid = m_object->getObject()->client()->getPID();
+
+    if (m_pid > 0) {
+        std::error_code ec;
+        m_binary = std::filesystem::read_symlink(std::format("/proc/{}/exe", m_pid), ec).string();
     }
 
     m_object->setSetIdentity([this](const char* name, const char* desc) {
@@ -411,50 +448,79 @@ CSecurityObject::CSecurityObject(SP<CHpHyprtavernSecurityObjectV1Object>&& obj,
     });
 
     m_object->setObtainPermission([this](hpHyprtavernCoreV1SecurityPermissionType type, hpHyprtavernCoreV1SecurityPermissionMode mode) {
-        // FIXME: impl thsi!!!!!! aBwgcvfdtyfwefctywevtyfwecvtyfgecvtyfgwetyfgvh FYUCKCKCKCKCK FUCKER
-
-        g_logger->log(LOG_WARN, "FIXME: obtain_permission is not impl'd I am a lazy fuck!");
+        if (!g_coreProto->m_policy.allows(m_binary, m_name, type, mode)) {
+            g_logger->log(LOG_DEBUG, "policy denies permission {} (mode {}) to {} ({})", sc<uint32_t>(type), sc<uint32_t>(mode), m_name, m_binary);
+            m_object->sendPermissionResult(type, HP_HYPRTAVERN_CORE_V1_SECURITY_PERMISSION_RESULT_DENIED_BY_POLICY);
+            return;
+        }
 
-        m_sessionPerms.emplace_back(type);
+        m_sessionPerms.add(type);
+        updateGrants();
 
         m_object->sendPermissionResult(type, HP_HYPRTAVERN_CORE_V1_SECURITY_PERMISSION_RESULT_GRANTED_BY_POLICY);
 
         // FIXME: send to kv persistent perms
     });
+}
 
-    if (!token.empty()) {
-        // try to find the token in the kv
-        const auto  FULL_TOKEN_K = std::format("token:{}", token);
+void CSecurityObject::resolve() {
+    if (!m_object->getObject())
+        return;
 
-        std::string data;
+    if (!g_coreProto->m_client.kvOpen) {
+        g_logger->log(LOG_DEBUG, "security object {} waits for the kv to open", m_id);
+        g_coreProto->m_kvQueue.emplace_back(m_id);
+        return;
+    }
 
-        g_coreProto->m_client.kvManager->sendGetValue(FULL_TOKEN_K.c_str(), HP_HYPRTAVERN_KV_STORE_V1_VALUE_TYPE_TAVERN_VALUE);
-        g_coreProto->m_client.kvManager->setValueObtained([&data](const char* k, const char* v, uint32_t type) { data = v; });
+    if (!m_requestedToken) {
+        finish();
+        return;
+    }
 
-        g_coreProto->m_sock->dispatchEvents();
+    // try to find the token in the kv, the answer comes in through CCoreProtocolHandler::onKvValue
+    const auto FULL_TOKEN_K = std::format("token:{}", m_requestedToken->toString());
 
-        if (data.empty())
-            g_logger->log(LOG_DEBUG, "received a token that is not in our kv, probably empty");
-        else {
-            // found the token
-            m_token = token;
+    g_coreProto->m_kvReads[FULL_TOKEN_K].emplace_back(m_id);
+    g_coreProto->m_barmaids.getValue(FULL_TOKEN_K);
+}
 
-            auto parsed = glz::read_json<SPersistenceTokenKvData>(data);
-            if (!parsed) {
-                g_logger->log(LOG_DEBUG, "kv returned a broken response for token, resetting");
-                g_coreProto->m_client.kvManager->sendSetValue(FULL_TOKEN_K.c_str(), glz::write_json(SPersistenceTokenKvData{})->c_str(),
-                                                              HP_HYPRTAVERN_KV_STORE_V1_VALUE_TYPE_TAVERN_VALUE);
-            } else {
-                // parsed successfully
-                m_kvData = *parsed;
-            }
+void CSecurityObject::onTokenData(const std::string& data) {
+    if (data.empty())
+        g_logger->log(LOG_DEBUG, "received a token that is not in our kv, probably empty");
+    else {
+        // found the token
+        m_token = *m_requestedToken;
+
+        auto parsed = glz::read_json<SPersistenceTokenKvData>(data);
+        if (!parsed) {
+            g_logger->log(LOG_DEBUG, "kv returned a broken response for token, resetting");
+            g_coreProto->m_barmaids.setValue(std::format("token:{}", m_token.toString()), *glz::write_json(SPersistenceTokenKvData{}));
+        } else {
+            // parsed successfully
+            m_kvData = *parsed;
+            updateGrants();
         }
     }
 
+    finish();
+}
+
+void CSecurityObject::updateGrants() {
+    m_grants = m_sessionPerms | SPermissionSet::fromVector(m_kvData.persistentPerms);
+    m_grants.toVector(m_grantList);
+
+    if (const auto MANAGER = m_manager.lock(); MANAGER)
+        MANAGER->m_grants = m_grants;
+}
+
+void CSecurityObject::finish() {
     if (m_token.empty())
         m_token = g_coreProto->generateToken();
 
-    m_object->sendToken(m_token.c_str());
+    g_coreProto->m_securityObjectsByToken[m_token] = m_id;
+
+    m_object->sendToken(m_token.toString().c_str());
 }
 
 CSecurityResponse::CSecurityResponse(SP<CHpHyprtavernSecurityResponseV1Object>&& obj, const std::string& oneTimeToken) : m_object(std::move(obj)) {
@@ -464,13 +530,15 @@ CSecurityResponse::CSecurityResponse(SP<CHpHyprtavernSecurityResponseV1Object>&&
     m_object->setOnDestroy([this]() { g_coreProto->removeObject(this); });
     m_object->setDestroy([this]() { g_coreProto->removeObject(this); });
 
-    if (!g_coreProto->m_oneTimeTokenMap.contains(oneTimeToken)) {
+    const auto ONE_TIME_TOKEN = SToken::fromString(oneTimeToken);
+    const auto REDEEMED       = ONE_TIME_TOKEN ? g_coreProto->redeemOneTimeToken(*ONE_TIME_TOKEN) : std::nullopt;
+
+    if (!REDEEMED) {
         m_object->sendFailed();
         return;
     }
 
-    auto token = g_coreProto->m_oneTimeTokenMap[oneTimeToken];
-    g_coreProto->m_oneTimeTokenMap.erase(oneTimeToken);
+    const auto token = *REDEEMED;
 
     if (token == g_coreProto->m_tavernkeepToken) {
         m_object->setRequery([this] {
@@ -486,13 +554,7 @@ CSecurityResponse::CSecurityResponse(SP<CHpHyprtavernSecurityResponseV1Object>&&
     }
 
     // find the object we are interested in
-    for (const auto& s : g_coreProto->m_securityObjects) {
-        if (s->m_token != token)
-            continue;
-
-        m_security = s;
-        break;
-    }
+    m_security = g_coreProto->securityObjectFor(token);
 
     if (!m_security) {
         m_object->sendFailed();
@@ -505,21 +567,13 @@ CSecurityResponse::CSecurityResponse(SP<CHpHyprtavernSecurityResponseV1Object>&&
             return;
         }
 
-        std::vector<uint32_t> perms = m_security->m_sessionPerms;
-        perms.reserve(m_security->m_sessionPerms.size() + m_security->m_kvData.persistentPerms.size());
-        perms.append_range(m_security->m_kvData.persistentPerms);
-
         m_object->sendIdentity(m_security->m_pid, m_security->m_name.c_str(), m_security->m_description.c_str());
-        m_object->sendPermissions(perms);
+        m_object->sendPermissions(m_security->m_grantList);
         m_object->sendDone();
     });
 
-    std::vector<uint32_t> perms = m_security->m_sessionPerms;
-    perms.reserve(m_security->m_sessionPerms.size() + m_security->m_kvData.persistentPerms.size());
-    perms.append_range(m_security->m_kvData.persistentPerms);
-
     m_object->sendIdentity(m_security->m_pid, m_security->m_name.c_str(), m_security->m_description.c_str());
-    m_object->sendPermissions(perms);
+    m_object->sendPermissions(m_security->m_grantList);
     m_object->sendDone();
 }
 
@@ -544,13 +598,8 @@ bool CCoreProtocolHandler::init(SP<Hyprwire::IServerSocket> sock) {
 
     m_client.sock = Hyprwire::IClientSocket::open(fds[1]);
 
-    {
-        std::random_device              dev;
-        std::mt19937_64                 engine(dev());
-        std::uniform_int_distribution<> distribution(0ULL, std::numeric_limits<int>::max());
-
-        m_tavernkeepToken = std::format("__tavernkeep__{}_{}__", distribution(engine), distribution(engine));
-    }
+    // never leaves the tavern, only recognizes our own connections
+    m_tavernkeepToken = generateToken();
 
     m_client.wireClient = m_sock->addClient(fds[0]);
 
@@ -558,23 +607,66 @@ bool CCoreProtocolHandler::init(SP<Hyprwire::IServerSocket> sock) {
 }
 
 void CCoreProtocolHandler::removeObject(CCoreManagerObject* obj) {
+    purgeOneTimeTokens(obj->m_oneTimeTokens);
+
     std::erase_if(m_managers, [obj](const auto& e) { return e.get() == obj; });
 }
 
 void CCoreProtocolHandler::removeObject(CBusQuery* obj) {
-    std::erase_if(m_queries, [obj](const auto& e) { return e.get() == obj; });
+    m_queries.remove(obj->m_id);
 }
 
 void CCoreProtocolHandler::removeObject(CBusObject* obj) {
-    std::erase_if(m_objects, [obj](const auto& e) { return e.get() == obj; });
+    if (!m_objects.contains(obj->m_internalID))
+        return;
+
+    purgeOneTimeTokens(obj->m_oneTimeTokens);
+
+    m_index.removeObject(*obj);
+
+    // the index is done with the names, they can go if nobody else exposes them
+    for (const auto& p : obj->m_protocols) {
+        g_atoms->release(p.name);
+    }
+
+    for (const auto& [k, v] : obj->m_props) {
+        g_atoms->release(k);
+    }
+
+    m_objects.remove(obj->m_internalID);
 }
 
 void CCoreProtocolHandler::removeObject(CBusObjectHandle* obj) {
-    std::erase_if(m_handles, [obj](const auto& e) { return e.get() == obj; });
+    m_handles.remove(obj->m_id);
 }
 
 void CCoreProtocolHandler::removeObject(CSecurityObject* obj) {
-    std::erase_if(m_securityObjects, [obj](const auto& e) { return e.get() == obj; });
+    if (!m_securityObjects.contains(obj->m_id))
+        return;
+
+    // its manager can't see anything through it anymore
+    if (const auto MANAGER = obj->m_manager.lock(); MANAGER)
+        MANAGER->m_grants = {};
+
+    // obj may not outlive the removal
+    const auto TOKEN = obj->m_token;
+    const auto ID    = obj->m_id;
+
+    m_securityObjects.remove(ID);
+
+    auto it = m_securityObjectsByToken.find(TOKEN);
+    if (it == m_securityObjectsByToken.end() || it->second != ID)
+        return;
+
+    m_securityObjectsByToken.erase(it);
+
+    // rare: another object on the same token, that one takes over
+    for (const auto& s : m_securityObjects) {
+        if (s->m_token == TOKEN) {
+            m_securityObjectsByToken[TOKEN] = s->m_id;
+            break;
+        }
+    }
 }
 
 void CCoreProtocolHandler::removeObject(CSecurityResponse* obj) {
@@ -582,102 +674,163 @@ void CCoreProtocolHandler::removeObject(CSecurityResponse* obj) {
 }
 
 SP<CBusObject> CCoreProtocolHandler::fromID(uint32_t id) {
-    for (const auto& o : m_objects) {
-        if (o->m_internalID != id)
-            continue;
+    return m_objects.get(id);
+}
 
-        return o;
+void CCoreProtocolHandler::resolveQueuedSecurityObjects() {
+    if (m_kvQueue.empty() || !m_client.kvOpen)
+        return;
+
+    // resolving may queue again
+    auto queued = std::move(m_kvQueue);
+    m_kvQueue.clear();
+
+    for (const auto& id : queued) {
+        if (const auto OBJ = m_securityObjects.get(id); OBJ)
+            OBJ->resolve();
     }
+}
 
-    return nullptr;
+void CCoreProtocolHandler::onKvValue(const std::string& key, const std::string& value) {
+    // the kv answers reads in order, so the oldest reader of this key is the one the value is for
+    auto it = m_kvReads.find(std::string_view{key});
+    if (it == m_kvReads.end()) {
+        g_logger->log(LOG_DEBUG, "kv sent a value for {} nobody asked for", key);
+        return;
+    }
+
+    const auto ID = it->second.front();
+    it->second.pop_front();
+
+    if (it->second.empty())
+        m_kvReads.erase(it);
+
+    if (const auto OBJ = m_securityObjects.get(ID); OBJ)
+        OBJ->onTokenData(value);
 }
 
-std::string CCoreProtocolHandler::generateToken() {
-    std::string uuid;
-    do {
-        uuid_t uuid_;
-        uuid_generate_random(uuid_);
-        uuid = std::format("{:02x}{:02x}{:02x}{:02x}-{:02x}{:02x}-{:02x}{:02x}-{:02x}{:02x}-{:02x}{:02x}{:02x}{:02x}{:02x}{:02x}", sc<uint16_t>(uuid_[0]), sc<uint16_t>(uuid_[1]),
-                           sc<uint16_t>(uuid_[2]), sc<uint16_t>(uuid_[3]), sc<uint16_t>(uuid_[4]), sc<uint16_t>(uuid_[5]), sc<uint16_t>(uuid_[6]), sc<uint16_t>(uuid_[7]),
-                           sc<uint16_t>(uuid_[8]), sc<uint16_t>(uuid_[9]), sc<uint16_t>(uuid_[10]), sc<uint16_t>(uuid_[11]), sc<uint16_t>(uuid_[12]), sc<uint16_t>(uuid_[13]),
-                           sc<uint16_t>(uuid_[14]), sc<uint16_t>(uuid_[15]));
-    } while (m_oneTimeTokenMap.contains(uuid));
+SP<CSecurityObject> CCoreProtocolHandler::securityObjectFor(const SToken& token) {
+    auto it = m_securityObjectsByToken.find(token);
+    if (it == m_securityObjectsByToken.end())
+        return nullptr;
 
-    return uuid;
+    return m_securityObjects.get(it->second);
 }
 
-bool CCoreProtocolHandler::initBarmaids() {
-    if (!m_client.sock->waitForHandshake()) {
-        g_logger->log(LOG_ERR, "CCoreProtocolHandler::initBarmaids: tavern handshake failed");
-        return false;
-    }
+SToken CCoreProtocolHandler::issueOneTimeToken(const SP<CCoreManagerObject>& manager, const SP<CBusObject>& object) {
+    // catch the wheel up first, delays are relative to where it is
+    expireOneTimeTokens();
 
-    m_client.sock->addImplementation(clientCoreImpl);
+    const auto TOKEN = generateToken();
 
-    const auto SPEC = m_client.sock->getSpec(clientCoreImpl->protocol()->specName());
+    m_oneTimeTokenMap[TOKEN] = SOneTimeToken{
+        .securityToken = manager->m_associatedSecurityToken,
+        .manager       = manager,
+        .objectID      = object->m_internalID,
+        .expires       = m_oneTimeTokenExpiry.schedule(TOKEN, ONE_TIME_TOKEN_TTL / ONE_TIME_TOKEN_TICK),
+    };
 
-    if (!SPEC) {
-        g_logger->log(LOG_ERR, "CCoreProtocolHandler::initBarmaids: failed because tavern doesn't support tavern proto??");
-        return false;
-    }
+    manager->m_oneTimeTokens.emplace_back(TOKEN);
+    object->m_oneTimeTokens.emplace_back(TOKEN);
 
-    // get the handle
-    auto manager = makeShared<CCHpHyprtavernCoreManagerV1Object>(m_client.sock->bindProtocol(clientCoreImpl->protocol(), TAVERN_PROTOCOL_VERSION));
+    return TOKEN;
+}
 
-    auto query = makeShared<CCHpHyprtavernBusQueryV1Object>(
-        manager->sendGetQueryObject({"hp_hyprtavern_kv_store_v1"}, HP_HYPRTAVERN_CORE_V1_BUS_QUERY_FILTER_MODE_ALL, {}, HP_HYPRTAVERN_CORE_V1_BUS_QUERY_FILTER_MODE_ALL));
+std::optional<SToken> CCoreProtocolHandler::redeemOneTimeToken(const SToken& oneTimeToken) {
+    auto it = m_oneTimeTokenMap.find(oneTimeToken);
+    if (it == m_oneTimeTokenMap.end())
+        return std::nullopt;
 
-    int fd = -1;
+    const auto SECURITY_TOKEN = it->second.securityToken;
+    dropOneTimeToken(it);
 
-    query->setResults([this, &manager, &fd](const std::vector<uint32_t>& res) {
-        if (res.empty())
-            return;
+    return SECURITY_TOKEN;
+}
 
-        auto handle = makeShared<CCHpHyprtavernBusObjectHandleV1Object>(manager->sendGetObjectHandle(res[0]));
-        handle->setSocket([&fd](int connFd) { fd = connFd; });
-        handle->sendConnect();
+void CCoreProtocolHandler::dropOneTimeToken(std::unordered_map<SToken, SOneTimeToken, STokenHash>::iterator it) {
+    const auto& [TOKEN, DATA] = *it;
 
-        m_client.sock->roundtrip();
-    });
+    if (const auto MANAGER = DATA.manager.lock(); MANAGER)
+        std::erase(MANAGER->m_oneTimeTokens, TOKEN);
 
-    m_client.sock->roundtrip();
+    if (const auto OBJ = fromID(DATA.objectID); OBJ)
+        std::erase(OBJ->m_oneTimeTokens, TOKEN);
 
-    if (fd < 0) {
-        g_logger->log(LOG_ERR, "CCoreProtocolHandler::initBarmaids: failed cuz bus has no kv?");
-        return false;
-    }
+    // a no-op when it's the wheel firing it
+    m_oneTimeTokenExpiry.cancel(TOKEN, DATA.expires);
 
-    m_client.kvSock = Hyprwire::IClientSocket::open(fd);
+    m_oneTimeTokenMap.erase(it);
+}
 
-    if (!m_client.kvSock->waitForHandshake()) {
-        g_logger->log(LOG_ERR, "CCoreProtocolHandler::initBarmaids: handshake failed");
-        return false;
+void CCoreProtocolHandler::purgeOneTimeTokens(std::vector<SToken>& tokens) {
+    // dropping erases from the list we're going through
+    auto toPurge = std::move(tokens);
+    tokens.clear();
+
+    for (const auto& t : toPurge) {
+        if (auto it = m_oneTimeTokenMap.find(t); it != m_oneTimeTokenMap.end())
+            dropOneTimeToken(it);
     }
 
-    m_client.kvSock->addImplementation(clientKvImpl);
-    m_client.kvSock->addImplementation(clientBarmaidImpl);
+    if (!toPurge.empty())
+        g_logger->log(LOG_DEBUG, "purged {} one-time tokens, {} outstanding", toPurge.size(), m_oneTimeTokenMap.size());
+}
 
-    // handshake is estabilished
+void CCoreProtocolHandler::expireOneTimeTokens() {
+    const uint64_t NOW     = (std::chrono::steady_clock::now() - m_oneTimeTokenEpoch) / ONE_TIME_TOKEN_TICK;
+    size_t         expired = 0;
 
-    m_client.kvManager        = makeShared<CCHpHyprtavernKvStoreManagerV1Object>(m_client.kvSock->bindProtocol(clientKvImpl->protocol(), KV_PROTOCOL_VERSION));
-    m_client.kvBarmaidManager = makeShared<CCHpHyprtavernBarmaidManagerV1Object>(m_client.kvSock->bindProtocol(clientBarmaidImpl->protocol(), MAID_PROTOCOL_VERSION));
+    // redeemed and purged tokens were cancelled, but be safe
+    m_oneTimeTokenExpiry.advance(NOW, [this, &expired](const SToken& token) {
+        auto it = m_oneTimeTokenMap.find(token);
+        if (it == m_oneTimeTokenMap.end())
+            return;
 
-    bool maidReady = false;
+        dropOneTimeToken(it);
+        expired++;
+    });
 
-    m_client.kvBarmaidManager->setReady([&maidReady] { maidReady = true; });
-    m_client.kvManager->setStoreAvailable([this] { m_client.kvOpen = true; });
+    if (expired)
+        g_logger->log(LOG_DEBUG, "expired {} one-time tokens, {} outstanding", expired, m_oneTimeTokenMap.size());
+}
 
-    while (true) {
-        if (!m_client.kvSock->dispatchEvents(true)) {
-            g_logger->log(LOG_ERR, "CCoreProtocolHandler::initBarmaids: failed, barmaid died");
-            return false;
-        }
+std::optional<std::chrono::steady_clock::time_point> CCoreProtocolHandler::nextOneTimeTokenExpiry() const {
+    const auto NEXT = m_oneTimeTokenExpiry.nextExpiry();
+    if (!NEXT)
+        return std::nullopt;
 
-        if (maidReady) {
-            g_logger->log(LOG_DEBUG, "CCoreProtocolHandler::initBarmaids: kv barmaid ready");
-            break;
+    // expireOneTimeTokens() gets to tick n once n whole ticks have passed since the epoch
+    return m_oneTimeTokenEpoch + *NEXT * ONE_TIME_TOKEN_TICK;
+}
+
+SToken CCoreProtocolHandler::generateToken() {
+    SToken token;
+
+    // 128 random bits won't collide in practice, but it's a cheap check now
+    do {
+        token = m_tokenService.generate();
+    } while (m_oneTimeTokenMap.contains(token));
+
+    return token;
+}
+
+bool CCoreProtocolHandler::startBarmaids(std::function<void()>&& notify) {
+    return m_barmaids.start(std::move(m_client.sock), std::move(notify));
+}
+
+bool CCoreProtocolHandler::dispatchBarmaidEvents() {
+    bool alive = true;
+
+    m_barmaids.dispatch([this, &alive](SBarmaidEvent& ev) {
+        switch (ev.type) {
+            case SBarmaidEvent::BARMAID_EVENT_READY: g_logger->log(LOG_DEBUG, "barmaids are ready"); break;
+            case SBarmaidEvent::BARMAID_EVENT_FAILED: alive = false; break;
+            case SBarmaidEvent::BARMAID_EVENT_STORE_AVAILABLE: m_client.kvOpen = true; break;
+            case SBarmaidEvent::BARMAID_EVENT_VALUE: onKvValue(ev.key, ev.value); break;
         }
-    }
+    });
 
-    return true;
+    resolveQueuedSecurityObjects();
+
+    return alive;
 }
@@ -1,18 +1,25 @@
 #pragma once
 
 #include <hp_hyprtavern_core_v1-server.hpp>
-#include <hp_hyprtavern_core_v1-client.hpp>
-#include <hp_hyprtavern_kv_store_v1-client.hpp>
-#include <hp_hyprtavern_barmaid_v1-client.hpp>
 
+#include "BarmaidThread.hpp"
+#include "BusIndex.hpp"
+#include "QueryCache.hpp"
+#include "QueryPlan.hpp"
+#include "TokenService.hpp"
+#include "PermissionPolicy.hpp"
 #include "../helpers/Memory.hpp"
+#include "../helpers/SlotMap.hpp"
+#include "../helpers/AtomTable.hpp"
+#include "../helpers/Hash.hpp"
+#include "../helpers/PermissionSet.hpp"
+#include "../helpers/TimerWheel.hpp"
 
-struct SQueryData {
-    std::vector<std::string>             protocolNames;
-    hpHyprtavernCoreV1BusQueryFilterMode protoFilter = HP_HYPRTAVERN_CORE_V1_BUS_QUERY_FILTER_MODE_ALL;
-    std::vector<std::string>             props;
-    hpHyprtavernCoreV1BusQueryFilterMode propFilter = HP_HYPRTAVERN_CORE_V1_BUS_QUERY_FILTER_MODE_ALL;
-};
+#include <chrono>
+#include <deque>
+#include <optional>
+
+constexpr const uint32_t TAVERN_PROTOCOL_VERSION = 1;
 
 struct SPersistenceTokenKvData {
     std::vector<uint32_t> persistentPerms;
@@ -22,10 +29,12 @@ class CSecurityObject;
 
 class CBusQuery {
   public:
-    CBusQuery(SP<CHpHyprtavernBusQueryV1Object>&& obj, SQueryData&& data);
+    // results are limited to what grants can see
+    CBusQuery(SP<CHpHyprtavernBusQueryV1Object>&& obj, SQueryData&& data, const SPermissionSet& grants);
     ~CBusQuery() = default;
 
     SQueryData m_data;
+    uint32_t   m_id = 0;
 
   private:
     SP<CHpHyprtavernBusQueryV1Object> m_object;
@@ -38,21 +47,37 @@ class CBusObject {
 
     void sendNewConnection(int fd, const std::string& token);
 
+    // what handles are sent about this object, serialized once and reused until protocols or props change
+    struct SDescriptor {
+        std::vector<const char*> protocolNames;
+        std::vector<uint32_t>    protocolRevs;
+        std::vector<std::string> props;
+        std::vector<const char*> propStrs;
+    };
+
+    const SDescriptor& descriptor();
+
+    // unredeemed one-time tokens for connections to this object
+    std::vector<SToken> m_oneTimeTokens;
+
     struct SProtocolExposeData {
-        std::string           name;
-        uint32_t              rev = 0;
-        std::vector<uint32_t> perms;
+        uint32_t       name = 0; // atom
+        uint32_t       rev  = 0;
+        SPermissionSet perms; // required to see the object has it
     };
 
-    std::vector<SProtocolExposeData>                 m_protocols;
-    std::vector<std::pair<std::string, std::string>> m_props;
+    std::vector<SProtocolExposeData>          m_protocols;
+    std::unordered_map<uint32_t, std::string> m_props; // key atom -> value
 
-    std::string                                      m_name;
+    std::string                               m_name;
 
-    size_t                                           m_internalID = 0;
+    uint32_t                                  m_internalID = 0;
 
   private:
     SP<CHpHyprtavernBusObjectV1Object> m_object;
+
+    SDescriptor                        m_descriptor;
+    bool                               m_descriptorDirty = true;
 };
 
 class CCoreManagerObject {
@@ -60,7 +85,13 @@ class CCoreManagerObject {
     CCoreManagerObject(SP<CHpHyprtavernCoreManagerV1Object>&& obj);
     ~CCoreManagerObject() = default;
 
-    std::string            m_associatedSecurityToken;
+    SToken                 m_associatedSecurityToken;
+
+    // what m_security was granted, kept in sync by it. Everything for the tavernkeep
+    SPermissionSet m_grants;
+
+    // unredeemed one-time tokens for connections this manager made
+    std::vector<SToken>    m_oneTimeTokens;
 
     WP<CCoreManagerObject> m_self;
     WP<CSecurityObject>    m_security;
@@ -76,14 +107,30 @@ class CSecurityObject {
     CSecurityObject(SP<CHpHyprtavernSecurityObjectV1Object>&& obj, SP<CCoreManagerObject> manager, const std::string& token);
     ~CSecurityObject() = default;
 
-    std::string             m_token, m_name, m_description;
+    // the token is only sent once the kv had its say. resolve() starts that, or queues it while the kv is locked,
+    // and is called once the object has an id. onTokenData() gets the kv's answer for the token we were created with
+    void                    resolve();
+    void                    onTokenData(const std::string& data);
+
+    SToken                  m_token;
+    std::string             m_name, m_description;
+    std::string             m_binary;
     WP<CCoreManagerObject>  m_manager;
     int                     m_pid = -1;
-    std::vector<uint32_t>   m_sessionPerms;
+    SPermissionSet          m_sessionPerms;
     SPersistenceTokenKvData m_kvData;
+    uint32_t                m_id = 0;
+
+    // session and persisted perms merged, redone by updateGrants() when either changes. m_grantList is the same, ready to send
+    SPermissionSet        m_grants;
+    std::vector<uint32_t> m_grantList;
+    void                  updateGrants();
 
   private:
+    void                                    finish();
+
     SP<CHpHyprtavernSecurityObjectV1Object> m_object;
+    std::optional<SToken>                   m_requestedToken;
 };
 
 class CSecurityResponse {
@@ -99,11 +146,17 @@ class CSecurityResponse {
 
 class CBusObjectHandle {
   public:
-    CBusObjectHandle(SP<CHpHyprtavernBusObjectHandleV1Object>&& obj, SP<CBusObject> busObject);
+    CBusObjectHandle(SP<CHpHyprtavernBusObjectHandleV1Object>&& obj, SP<CBusObject> busObject, SP<CCoreManagerObject> manager);
     ~CBusObjectHandle() = default;
 
+    // descriptor: the protocols the manager may see and props, then done, sent once on creation.
+    // visible: whether the manager's grants cover any of the object's protocols, connecting is refused otherwise
+    void                   sendDescriptor();
+    bool                   visible() const;
+
     WP<CBusObject>         m_busObject;
     WP<CCoreManagerObject> m_manager;
+    uint32_t               m_id = 0;
 
   private:
     SP<CHpHyprtavernBusObjectHandleV1Object> m_object;
@@ -115,7 +168,11 @@ class CCoreProtocolHandler {
     ~CCoreProtocolHandler() = default;
 
     bool init(SP<Hyprwire::IServerSocket> sock);
-    bool initBarmaids();
+
+    // hands our own connection to the barmaid thread, which finds the kv through it. notify wakes the main loop up for
+    // dispatchBarmaidEvents, which returns false once the barmaids are lost
+    bool startBarmaids(std::function<void()>&& notify);
+    bool dispatchBarmaidEvents();
 
     //
     void removeObject(CCoreManagerObject* obj);
@@ -127,31 +184,68 @@ class CCoreProtocolHandler {
 
     //
     std::vector<SP<CCoreManagerObject>> m_managers;
-    std::vector<SP<CBusObject>>         m_objects;
-    std::vector<SP<CBusObjectHandle>>   m_handles;
-    std::vector<SP<CBusQuery>>          m_queries;
-    std::vector<SP<CSecurityObject>>    m_securityObjects;
+    CSlotMap<CBusObject>                m_objects;
+    CSlotMap<CBusObjectHandle>          m_handles;
+    CSlotMap<CBusQuery>                 m_queries;
+    CSlotMap<CSecurityObject>           m_securityObjects;
     std::vector<SP<CSecurityResponse>>  m_securityResponses;
 
     SP<CBusObject>                      fromID(uint32_t id);
 
+    // security token -> security object id. With several objects on one token, the newest one
+    std::unordered_map<SToken, uint32_t, STokenHash> m_securityObjectsByToken;
+    SP<CSecurityObject>                              securityObjectFor(const SToken& token);
+
+    CBusIndex                           m_index;
+    CQueryCache                         m_queryCache;
+
     WP<Hyprwire::IServerSocket>         m_sock;
 
     struct {
-        SP<Hyprwire::IClientSocket>              sock;
-        SP<Hyprwire::IClientSocket>              kvSock;
-
-        SP<CCHpHyprtavernKvStoreManagerV1Object> kvManager;
-        SP<CCHpHyprtavernBarmaidManagerV1Object> kvBarmaidManager;
-        bool                                     kvOpen = false;
-        WP<Hyprwire::IServerClient>              wireClient;
+        SP<Hyprwire::IClientSocket> sock; // the barmaid thread's once it's started
+        bool                        kvOpen = false;
+        WP<Hyprwire::IServerClient> wireClient;
     } m_client;
 
-    std::string                                  m_tavernkeepToken = "__tavernkeep__";
+    SToken                      m_tavernkeepToken;
+
+    // everything sent to or received from barmaids goes through here
+    CBarmaidThread m_barmaids;
+
+    // one-time token -> what it was issued for. A token is handed to the target object on connect and redeemed by a barmaid,
+    // unredeemed ones expire after a while, or when the manager or object they were issued for goes away.
+    struct SOneTimeToken {
+        SToken                 securityToken;
+        WP<CCoreManagerObject> manager;
+        uint32_t               objectID = 0;
+        uint64_t               expires  = 0; // wheel tick, to cancel it with
+    };
+
+    std::unordered_map<SToken, SOneTimeToken, STokenHash> m_oneTimeTokenMap;
+    CTimerWheel<SToken>                                   m_oneTimeTokenExpiry;
+    std::chrono::steady_clock::time_point                 m_oneTimeTokenEpoch = std::chrono::steady_clock::now();
+
+    SToken                                                issueOneTimeToken(const SP<CCoreManagerObject>& manager, const SP<CBusObject>& object);
+    std::optional<SToken>                                 redeemOneTimeToken(const SToken& oneTimeToken);
+    void                                                  dropOneTimeToken(std::unordered_map<SToken, SOneTimeToken, STokenHash>::iterator it);
+    void                                                  purgeOneTimeTokens(std::vector<SToken>& tokens);
+
+    // called from the main loop when the next expiry is due, nullopt if nothing is pending
+    void                                                 expireOneTimeTokens();
+    std::optional<std::chrono::steady_clock::time_point> nextOneTimeTokenExpiry() const;
+
+    CTokenService m_tokenService;
+    SToken        generateToken();
+
+    // swapped out by CServerHandler when the policy file changes
+    CPermissionPolicy m_policy = CPermissionPolicy::permissive();
 
-    std::unordered_map<std::string, std::string> m_oneTimeTokenMap;
+    // security objects waiting on the kv, by id. Queued while it's locked, then by the key they read
+    std::vector<uint32_t>                                                               m_kvQueue;
+    std::unordered_map<std::string, std::deque<uint32_t>, SStringHash, std::equal_to<>> m_kvReads;
 
-    std::string                                  generateToken();
+    void                                                                                resolveQueuedSecurityObjects();
+    void                                                                                onKvValue(const std::string& key, const std::string& value);
 };
 
 inline UP<CCoreProtocolHandler> g_coreProto;
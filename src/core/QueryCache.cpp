@@ -0,0 +1,62 @@
+#include "QueryCache.hpp"
+
+#include <algorithm>
+#include <format>
+
+constexpr const size_t MAX_CACHE_ENTRIES = 256;
+
+//
+static void appendNormalized(std::string& key, std::vector<std::string> strs) {
+    std::ranges::sort(strs);
+    const auto [first, last] = std::ranges::unique(strs);
+    strs.erase(first, last);
+
+    // strings off the wire can't contain a NUL, so it's a safe separator
+    for (const auto& s : strs) {
+        key += s;
+        key += '\0';
+    }
+}
+
+std::string CQueryCache::keyFor(const SQueryData& data, const SPermissionSet& grants) {
+    std::string key = std::format("{}:{}:{:x}:", sc<uint32_t>(data.protoFilter), sc<uint32_t>(data.propFilter), grants.bits);
+
+    appendNormalized(key, data.protocolNames);
+    key += '\n';
+    appendNormalized(key, data.props);
+
+    return key;
+}
+
+const std::vector<uint32_t>* CQueryCache::get(const std::string& key, uint64_t epoch) {
+    if (epoch != m_epoch) {
+        m_entries.clear();
+        m_epoch = epoch;
+    }
+
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) {
+        m_stats.misses++;
+        return nullptr;
+    }
+
+    m_stats.hits++;
+    return &it->second;
+}
+
+void CQueryCache::put(std::string key, uint64_t epoch, std::vector<uint32_t> results) {
+    if (epoch != m_epoch) {
+        m_entries.clear();
+        m_epoch = epoch;
+    }
+
+    // a burst of unique queries between mutations shouldn't grow this forever
+    if (m_entries.size() >= MAX_CACHE_ENTRIES)
+        m_entries.clear();
+
+    m_entries.emplace(std::move(key), std::move(results));
+}
+
+const CQueryCache::SStats& CQueryCache::stats() const {
+    return m_stats;
+}
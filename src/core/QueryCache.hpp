@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include "BusIndex.hpp"
+#include "../helpers/Hash.hpp"
+
+// Caches query results between registry mutations. Entries are only valid for the index epoch
+// they were computed at, the first lookup at a newer epoch drops everything.
+class CQueryCache {
+  public:
+    CQueryCache()  = default;
+    ~CQueryCache() = default;
+
+    CQueryCache(const CQueryCache&) = delete;
+    CQueryCache(CQueryCache&)       = delete;
+    CQueryCache(CQueryCache&&)      = delete;
+
+    struct SStats {
+        uint64_t hits = 0, misses = 0;
+    };
+
+    // normalized key: name and prop order, and duplicates, don't change the result.
+    // Results depend on grants while any protocol on the bus requires perms, pass empty ones otherwise so callers share entries
+    static std::string           keyFor(const SQueryData& data, const SPermissionSet& grants);
+
+    const std::vector<uint32_t>* get(const std::string& key, uint64_t epoch);
+    void                         put(std::string key, uint64_t epoch, std::vector<uint32_t> results);
+
+    const SStats&                stats() const;
+
+  private:
+    uint64_t                                                                             m_epoch = 0;
+    std::unordered_map<std::string, std::vector<uint32_t>, SStringHash, std::equal_to<>> m_entries;
+    SStats                                                                               m_stats;
+};
@@ -0,0 +1,116 @@
+#include "QueryPlan.hpp"
+#include "../helpers/AtomTable.hpp"
+
+#include <algorithm>
+#include <format>
+
+//
+static CQueryPlan::SNode protocolNode(const std::string_view& name) {
+    if (name.ends_with('*'))
+        return CQueryPlan::SNode{.type = CQueryPlan::NODE_PROTOCOL_PREFIX, .lookup = std::string{name.substr(0, name.size() - 1)}};
+
+    // queries only look atoms up, so they can't grow the atom table. A name that was never interned isn't on the bus,
+    // and its leaf stays empty: no object has the INVALID atom
+    return CQueryPlan::SNode{.type = CQueryPlan::NODE_PROTOCOL_EXACT, .lookup = std::string{name}, .atom = g_atoms->find(name)};
+}
+
+static std::expected<CQueryPlan::SNode, std::string> propertyNode(const std::string_view& p) {
+    const auto EQ_POS = p.find('=');
+
+    if (EQ_POS == std::string::npos) {
+        // only a key prefix can go without a value
+        if (!p.ends_with('*') || p.size() < 2 || std::ranges::count(p, '*') != 1)
+            return std::unexpected(std::format("Invalid property in query: {}", p));
+
+        return CQueryPlan::SNode{.type = CQueryPlan::NODE_PROPERTY_KEY_PREFIX, .lookup = std::string{p.substr(0, p.size() - 1)}};
+    }
+
+    const auto KEY   = std::string{p.substr(0, EQ_POS)};
+    const auto VALUE = std::string{p.substr(EQ_POS + 1)};
+
+    if (KEY.empty() || KEY.contains('*'))
+        return std::unexpected(std::format("Invalid property in query: {}", p));
+
+    if (VALUE.ends_with('*'))
+        return CQueryPlan::SNode{.type = CQueryPlan::NODE_PROPERTY_VALUE_PREFIX, .lookup = std::format("{}={}", KEY, VALUE.substr(0, VALUE.size() - 1))};
+
+    return CQueryPlan::SNode{.type = CQueryPlan::NODE_PROPERTY_EXACT, .lookup = std::string{p}};
+}
+
+std::expected<CQueryPlan, std::string> CQueryPlan::compile(const SQueryData& data) {
+    CQueryPlan plan;
+
+    // ALL groups are spliced into the root, ANY groups become an OR under it
+    const auto APPEND_GROUP = [&plan](std::vector<SNode>&& nodes, hpHyprtavernCoreV1BusQueryFilterMode mode) {
+        if (nodes.empty())
+            return;
+
+        if (mode == HP_HYPRTAVERN_CORE_V1_BUS_QUERY_FILTER_MODE_ALL) {
+            plan.m_root.children.append_range(std::move(nodes));
+            return;
+        }
+
+        plan.m_root.children.emplace_back(SNode{.type = NODE_OR, .children = std::move(nodes)});
+    };
+
+    std::vector<SNode> protocols, props;
+    protocols.reserve(data.protocolNames.size());
+    props.reserve(data.props.size());
+
+    for (const auto& p : data.protocolNames) {
+        protocols.emplace_back(protocolNode(p));
+    }
+
+    for (const auto& p : data.props) {
+        auto node = propertyNode(p);
+        if (!node)
+            return std::unexpected(node.error());
+
+        props.emplace_back(std::move(*node));
+    }
+
+    APPEND_GROUP(std::move(protocols), data.protoFilter);
+    APPEND_GROUP(std::move(props), data.propFilter);
+
+    return plan;
+}
+
+static CBitmap evaluate(const CQueryPlan::SNode& n, const CBusIndex& index, const SPermissionSet& grants) {
+    switch (n.type) {
+        case CQueryPlan::NODE_AND: {
+            // an empty AND matches everything
+            if (n.children.empty())
+                return index.allObjects();
+
+            CBitmap result = evaluate(n.children.front(), index, grants);
+
+            for (size_t i = 1; i < n.children.size() && !result.empty(); ++i) {
+                result &= evaluate(n.children[i], index, grants);
+            }
+
+            return result;
+        }
+        case CQueryPlan::NODE_OR: {
+            CBitmap result;
+            for (const auto& c : n.children) {
+                result |= evaluate(c, index, grants);
+            }
+            return result;
+        }
+        case CQueryPlan::NODE_PROTOCOL_EXACT: return index.objectsWithProtocol(n.atom, grants);
+        case CQueryPlan::NODE_PROTOCOL_PREFIX: return index.objectsWithProtocolPrefix(n.lookup, grants);
+        case CQueryPlan::NODE_PROPERTY_EXACT: return index.objectsWithProperty(n.lookup);
+        case CQueryPlan::NODE_PROPERTY_VALUE_PREFIX:
+        case CQueryPlan::NODE_PROPERTY_KEY_PREFIX: return index.objectsWithPropertyPrefix(n.lookup);
+    }
+
+    return {};
+}
+
+std::vector<uint32_t> CQueryPlan::run(const CBusIndex& index, const SPermissionSet& grants) const {
+    auto ids = index.idsOf(evaluate(m_root, index, grants));
+
+    // an object with nothing but hidden protocols isn't there at all, even for a query without protocol terms
+    index.filterVisible(ids, grants);
+    return ids;
+}
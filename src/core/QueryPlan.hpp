@@ -0,0 +1,49 @@
+#pragma once
+
+#include <expected>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#include "BusIndex.hpp"
+
+// A bus query, parsed and validated once into a tree of ANDs and ORs over its terms.
+// Protocol names may end in a '*' to match by prefix.
+// Props are "key=value", "key=prefix*" for a value prefix, or "ns:*" / "ns:ke*" for any value of keys with that prefix.
+class CQueryPlan {
+  public:
+    CQueryPlan()  = default;
+    ~CQueryPlan() = default;
+
+    // names that aren't on the bus compile into leaves that never match
+    static std::expected<CQueryPlan, std::string> compile(const SQueryData& data);
+
+    // evaluate against the whole bus, protocols grants don't cover don't match
+    std::vector<uint32_t> run(const CBusIndex& index, const SPermissionSet& grants) const;
+
+    enum eNodeType : uint8_t {
+        NODE_AND = 0,
+        NODE_OR,
+        NODE_PROTOCOL_EXACT,
+        NODE_PROTOCOL_PREFIX,
+        NODE_PROPERTY_EXACT,
+        NODE_PROPERTY_VALUE_PREFIX,
+        NODE_PROPERTY_KEY_PREFIX,
+    };
+
+    struct SNode {
+        eNodeType type = NODE_AND;
+
+        // leaves: what the index is looked up with, the protocol name (prefix) or "key=value" (prefix)
+        std::string lookup;
+
+        // interned protocol name, for the exact protocol leaves
+        uint32_t           atom = 0;
+
+        std::vector<SNode> children;
+    };
+
+    // an empty AND, matches everything
+    SNode m_root;
+};
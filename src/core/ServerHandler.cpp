@@ -3,6 +3,7 @@
 
 #include "../helpers/Logger.hpp"
 
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <cstdlib>
@@ -12,12 +13,15 @@
 #include <sys/signal.h>
 #include <sys/socket.h>
 #include <sys/fcntl.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
 
 #include <hyprutils/os/File.hpp>
 
 constexpr const char* SOCKET_FILE_NAME = "ht.sock";
 constexpr const char* LOCK_FILE_NAME   = ".ht-lock";
+constexpr const char* POLICY_FILE_NAME = "hyprtavern-policy.conf";
 
 //
 static std::string runtimeDir() {
@@ -27,18 +31,42 @@ static std::string runtimeDir() {
     return ENV;
 };
 
-static void onSignal(int sig) {
-    if (g_serverHandler)
-        g_serverHandler->exit();
+static std::string policyPath() {
+    if (const auto CONFIG = getenv("XDG_CONFIG_HOME"); CONFIG && *CONFIG)
+        return std::format("{}/hypr/{}", CONFIG, POLICY_FILE_NAME);
+
+    if (const auto HOME = getenv("HOME"); HOME && *HOME)
+        return std::format("{}/.config/hypr/{}", HOME, POLICY_FILE_NAME);
+
+    return "";
+}
+
+static std::expected<CPermissionPolicy, std::string> compilePolicy(const std::string& path) {
+    std::error_code ec;
+
+    // no file, no restrictions
+    if (!std::filesystem::exists(path, ec))
+        return CPermissionPolicy::permissive();
+
+    return CPermissionPolicy::compile(path);
 }
 
 void CServerHandler::exit() {
-    m_exit = true;
+    m_loop->exit();
 }
 
 CServerHandler::CServerHandler() {
     signal(SIGCHLD, SIG_IGN);
 
+    // first, SIGTERM and SIGINT have to be blocked before any thread is around to catch them
+    m_loop = makeUnique<CEventLoop>();
+
+    if (!m_loop->good()) {
+        g_logger->log(LOG_ERR, "refusing to run: failed to create the event loop");
+        ::exit(1);
+        return;
+    }
+
     const auto RUNTIME_DIR = runtimeDir();
 
     if (RUNTIME_DIR.empty()) {
@@ -72,18 +100,35 @@ CServerHandler::CServerHandler() {
         return;
     }
 
-    signal(SIGTERM, ::onSignal);
-    signal(SIGINT, ::onSignal);
-
     g_coreProto = makeUnique<CCoreProtocolHandler>();
     if (!g_coreProto->init(m_socket)) {
         g_logger->log(LOG_ERR, "refusing to run: failed to init proto");
         ::exit(1);
         return;
     }
+
+    m_policyPath = policyPath();
+
+    if (!m_policyPath.empty()) {
+        if (auto policy = compilePolicy(m_policyPath); policy)
+            g_coreProto->m_policy = std::move(*policy);
+        else
+            g_logger->log(LOG_ERR, "failed to load the permission policy at {}, allowing everything: {}", m_policyPath, policy.error());
+
+        watchPolicy();
+    }
 }
 
 CServerHandler::~CServerHandler() {
+    // it notifies through the loop
+    if (g_coreProto)
+        g_coreProto->m_barmaids.stop();
+
+    if (m_policyWatchFD >= 0) {
+        m_loop->removeFD(m_policyWatchFD);
+        close(m_policyWatchFD);
+    }
+
     m_socket.reset();
     removeFiles();
 }
@@ -94,65 +139,68 @@ bool CServerHandler::run() {
         return false;
     }
 
-    pollfd fds[2] = {
-        pollfd{
-            .fd     = m_socket->extractLoopFD(),
-            .events = POLLIN,
-        },
-        pollfd{
-            .revents = 0,
-        },
-    };
-
-    bool               barmaidInitCommenced = false, barmaidInitDone = false;
-    std::promise<bool> barmaidInitResult;
-    std::future<bool>  barmaidInitFuture = barmaidInitResult.get_future();
-
-    while (!m_exit) {
-        if (poll(fds, barmaidInitDone ? 2 : 1, -1) < 0) {
-            g_logger->log(LOG_ERR, "poll() failed");
-            exit();
-            return false;
-        }
+    m_tokenExpiryTimer = m_loop->addTimer([this] {
+        m_tokenExpiryDeadline.reset();
+        g_coreProto->expireOneTimeTokens();
+    });
+    m_barmaidWakeup    = m_loop->addWakeup([this] { onBarmaidEvents(); });
 
-        // TODO: restrict new clients connecting until barmaids are init'd
+    if (!m_tokenExpiryTimer || !m_barmaidWakeup || !m_loop->addFD(m_socket->extractLoopFD(), [this](uint32_t events) { onSocketEvents(events); })) {
+        g_logger->log(LOG_ERR, "refusing to run: failed to set up the event loop");
+        return false;
+    }
 
-        if (fds[0].revents & POLLIN)
-            m_socket->dispatchEvents();
-        if (fds[1].revents & POLLIN)
-            g_coreProto->m_client.kvSock->dispatchEvents();
+    m_loop->setOnIdle([this] { updateTokenExpiryTimer(); });
 
-        if (!barmaidInitCommenced && g_coreProto->m_managers.size() >= 1 /* kv_store */) {
-            barmaidInitCommenced = true;
-            std::thread t([&barmaidInitResult] { barmaidInitResult.set_value(g_coreProto->initBarmaids()); });
-            t.detach();
-        }
+    return m_loop->run();
+}
 
-        if (!barmaidInitDone && barmaidInitFuture.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
-            barmaidInitDone = true;
-            if (!barmaidInitFuture.get()) {
-                g_logger->log(LOG_ERR, "barmaid init failed");
-                exit();
-                return false;
-            }
+void CServerHandler::onSocketEvents(uint32_t events) {
+    // TODO: restrict new clients connecting until barmaids are init'd
 
-            fds[1].fd     = g_coreProto->m_client.kvSock->extractLoopFD();
-            fds[1].events = POLLIN;
-        }
+    if (events & EPOLLIN)
+        m_socket->dispatchEvents();
 
-        if (fds[0].revents & POLLHUP) {
-            g_logger->log(LOG_ERR, "socket fd died");
-            return true;
-        }
+    if (!m_barmaidsStarted && g_coreProto->m_managers.size() >= 1 /* kv_store */) {
+        m_barmaidsStarted = true;
 
-        if (fds[1].revents & POLLHUP) {
-            g_logger->log(LOG_ERR, "tavernkeep fd died");
-            exit();
-            return false;
+        if (!g_coreProto->startBarmaids([wakeup = m_barmaidWakeup.get()] { wakeup->signal(); })) {
+            g_logger->log(LOG_ERR, "failed to start the barmaid thread");
+            m_loop->exit(false);
         }
     }
 
-    return true;
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        g_logger->log(LOG_ERR, "socket fd died");
+        m_loop->exit();
+    }
+}
+
+void CServerHandler::onBarmaidEvents() {
+    if (!g_coreProto->dispatchBarmaidEvents()) {
+        g_logger->log(LOG_ERR, "lost the barmaids");
+        m_loop->exit(false);
+    }
+}
+
+void CServerHandler::updateTokenExpiryTimer() {
+    // only touch the timerfd when the earliest expiry moved, which is when a token was issued into an empty wheel,
+    // or the earliest one expired or went away
+    const auto NEXT = g_coreProto->nextOneTimeTokenExpiry();
+
+    if (NEXT == m_tokenExpiryDeadline)
+        return;
+
+    m_tokenExpiryDeadline = NEXT;
+
+    if (!NEXT) {
+        m_tokenExpiryTimer->arm(-1);
+        return;
+    }
+
+    // rounded up, firing early would just mean another round trip
+    const auto IN = std::chrono::ceil<std::chrono::milliseconds>(*NEXT - std::chrono::steady_clock::now());
+    m_tokenExpiryTimer->arm(std::max<int>(IN.count(), 0));
 }
 
 bool CServerHandler::isAlreadyRunning() {
@@ -229,6 +277,94 @@ void CServerHandler::removeFiles() {
         g_logger->log(LOG_ERR, "failed to remove socket file");
 }
 
+void CServerHandler::watchPolicy() {
+    m_policyWatchFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (m_policyWatchFD < 0) {
+        g_logger->log(LOG_WARN, "failed to init inotify, the permission policy won't be reloaded");
+        return;
+    }
+
+    // watch the directory, editors tend to replace the file instead of writing to it
+    const auto DIR = std::filesystem::path(m_policyPath).parent_path();
+
+    if (inotify_add_watch(m_policyWatchFD, DIR.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE) < 0) {
+        g_logger->log(LOG_DEBUG, "can't watch {}, the permission policy won't be reloaded", DIR.string());
+        close(m_policyWatchFD);
+        m_policyWatchFD = -1;
+        return;
+    }
+
+    m_policyReloadWakeup = m_loop->addWakeup([this] { finishPolicyReload(); });
+
+    if (!m_policyReloadWakeup || !m_loop->addFD(m_policyWatchFD, [this](uint32_t) { onPolicyChanged(); })) {
+        g_logger->log(LOG_WARN, "failed to watch the permission policy, it won't be reloaded");
+        close(m_policyWatchFD);
+        m_policyWatchFD = -1;
+    }
+}
+
+void CServerHandler::onPolicyChanged() {
+    const auto FILE_NAME = std::filesystem::path(m_policyPath).filename().string();
+    bool       relevant  = false;
+
+    alignas(inotify_event) char buf[4096];
+    ssize_t                     len = 0;
+
+    while ((len = read(m_policyWatchFD, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + len;) {
+            const auto* EVENT = rc<const inotify_event*>(p);
+
+            if (EVENT->len && FILE_NAME == EVENT->name)
+                relevant = true;
+
+            p += sizeof(inotify_event) + EVENT->len;
+        }
+    }
+
+    if (!relevant)
+        return;
+
+    // editors write in bursts, don't stack reloads up. The one in flight might have read an old version though
+    if (m_policyReload.valid()) {
+        m_policyChangedAgain = true;
+        return;
+    }
+
+    reloadPolicy();
+}
+
+void CServerHandler::reloadPolicy() {
+    g_logger->log(LOG_DEBUG, "permission policy at {} changed, reloading", m_policyPath);
+
+    std::promise<std::expected<CPermissionPolicy, std::string>> promise;
+    m_policyReload = promise.get_future();
+
+    // the result has to be in before the wakeup, finishPolicyReload takes it without waiting
+    m_policyReloadThread = std::jthread([path = m_policyPath, wakeup = m_policyReloadWakeup.get(), promise = std::move(promise)]() mutable {
+        promise.set_value(compilePolicy(path));
+        wakeup->signal();
+    });
+}
+
+void CServerHandler::finishPolicyReload() {
+    if (!m_policyReload.valid())
+        return;
+
+    auto policy = m_policyReload.get();
+
+    if (policy) {
+        g_coreProto->m_policy = std::move(*policy);
+        g_logger->log(LOG_DEBUG, "permission policy reloaded");
+    } else
+        g_logger->log(LOG_ERR, "failed to reload the permission policy, keeping the old one: {}", policy.error());
+
+    if (m_policyChangedAgain) {
+        m_policyChangedAgain = false;
+        reloadPolicy();
+    }
+}
+
 bool CServerHandler::good() {
     return m_socket;
 }
@@ -249,6 +385,11 @@ static pid_t launch(const std::string& app, const std::vector<std::string>& para
     }
 
     if (fk == 0) {
+        // the mask survives exec, barmaids want their SIGTERM
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, nullptr);
+
         execvp(app.c_str(), cc<char* const*>(argv.data()));
         g_logger->log(LOG_ERR, "failed to execv {}", app);
         exit(1);
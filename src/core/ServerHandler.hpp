@@ -2,6 +2,14 @@
 
 #include <hyprwire/hyprwire.hpp>
 
+#include <chrono>
+#include <expected>
+#include <future>
+#include <optional>
+#include <thread>
+
+#include "EventLoop.hpp"
+#include "PermissionPolicy.hpp"
 #include "../helpers/Memory.hpp"
 
 class CCoreProtocolHandler;
@@ -23,9 +31,35 @@ class CServerHandler {
 
     bool                        launchBarmaids();
 
-    bool                        m_exit = false;
+    void                        onSocketEvents(uint32_t events);
+    void                        onBarmaidEvents();
+    void                        updateTokenExpiryTimer();
 
+    UP<CEventLoop>              m_loop;
     SP<Hyprwire::IServerSocket> m_socket;
+
+    // armed for the earliest one-time token expiry, if there is one
+    WP<CEventLoopTimer>                                  m_tokenExpiryTimer;
+    std::optional<std::chrono::steady_clock::time_point> m_tokenExpiryDeadline;
+
+    // the barmaid thread wakes the loop up when it queued events
+    WP<CEventLoopWakeup>        m_barmaidWakeup;
+    bool                        m_barmaidsStarted = false;
+
+    // the policy file is watched with inotify and recompiled off the main thread when it changes
+    void                                                       watchPolicy();
+    void                                                       onPolicyChanged();
+    void                                                       reloadPolicy();
+    void                                                       finishPolicyReload();
+
+    std::string                                                m_policyPath;
+    int                                                        m_policyWatchFD = -1;
+    WP<CEventLoopWakeup>                                       m_policyReloadWakeup;
+    std::future<std::expected<CPermissionPolicy, std::string>> m_policyReload;
+    bool                                                       m_policyChangedAgain = false;
+
+    // signals through m_loop, so it's joined before that goes
+    std::jthread m_policyReloadThread;
 };
 
 inline UP<CServerHandler> g_serverHandler;
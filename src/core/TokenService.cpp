@@ -0,0 +1,54 @@
+#include "TokenService.hpp"
+#include "../helpers/Logger.hpp"
+
+#include <random>
+#include <cerrno>
+
+#include <sys/random.h>
+
+//
+void CTokenService::refill() {
+    auto*  data = rc<uint8_t*>(m_pool.data());
+    size_t got  = 0;
+
+    while (got < sizeof(m_pool)) {
+        const auto RET = getrandom(data + got, sizeof(m_pool) - got, 0);
+
+        if (RET < 0) {
+            if (errno == EINTR)
+                continue;
+
+            break;
+        }
+
+        got += RET;
+    }
+
+    if (got < sizeof(m_pool)) {
+        g_logger->log(LOG_WARN, "getrandom() failed, falling back to std::random_device for tokens");
+
+        std::random_device dev;
+        for (auto& t : m_pool) {
+            t.hi = (uint64_t{dev()} << 32) | dev();
+            t.lo = (uint64_t{dev()} << 32) | dev();
+        }
+    }
+
+    m_next = 0;
+}
+
+SToken CTokenService::generate() {
+    SToken token;
+
+    do {
+        if (m_next >= m_pool.size())
+            refill();
+
+        token = m_pool[m_next];
+
+        // don't keep handed out tokens around
+        m_pool[m_next++] = SToken{};
+    } while (token.empty());
+
+    return token;
+}
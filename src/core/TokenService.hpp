@@ -0,0 +1,27 @@
+#pragma once
+
+#include <array>
+
+#include "../helpers/Token.hpp"
+
+// Hands out random tokens. Randomness is read from the kernel a pool at a time, not per token.
+class CTokenService {
+  public:
+    CTokenService()  = default;
+    ~CTokenService() = default;
+
+    CTokenService(const CTokenService&) = delete;
+    CTokenService(CTokenService&)       = delete;
+    CTokenService(CTokenService&&)      = delete;
+
+    // never empty
+    SToken generate();
+
+  private:
+    void                          refill();
+
+    constexpr static size_t       POOL_SIZE = 64;
+
+    std::array<SToken, POOL_SIZE> m_pool;
+    size_t                        m_next = POOL_SIZE;
+};
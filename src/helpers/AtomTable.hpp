@@ -0,0 +1,89 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include "Memory.hpp"
+
+// Interns strings into small integer atoms. Atoms are refcounted: intern() takes a reference, release() drops one, and
+// a string is freed once nothing holds it anymore, its atom may then be handed out again. Bus objects hold the atoms
+// of what they expose. Anything else, like names in client queries, is only looked up with find().
+class CAtomTable {
+  public:
+    CAtomTable()  = default;
+    ~CAtomTable() = default;
+
+    CAtomTable(const CAtomTable&) = delete;
+    CAtomTable(CAtomTable&)       = delete;
+    CAtomTable(CAtomTable&&)      = delete;
+
+    // 0 is never a valid atom
+    constexpr static uint32_t INVALID = 0;
+
+    // returns the existing atom if str is interned already. Either way, the caller holds a reference until release()
+    uint32_t intern(const std::string_view& str) {
+        if (const auto ATOM = find(str); ATOM != INVALID) {
+            m_refs[ATOM - 1]++;
+            return ATOM;
+        }
+
+        uint32_t atom = INVALID;
+
+        if (!m_free.empty()) {
+            atom = m_free.back();
+            m_free.pop_back();
+            m_strings[atom - 1] = str;
+            m_refs[atom - 1]    = 1;
+        } else {
+            m_strings.emplace_back(str);
+            m_refs.emplace_back(1);
+            atom = m_strings.size();
+        }
+
+        // deque doesn't move elements on growth, so the views in m_atoms stay valid
+        m_atoms.emplace(m_strings[atom - 1], atom);
+        return atom;
+    }
+
+    void release(uint32_t atom) {
+        if (atom == INVALID || --m_refs[atom - 1] > 0)
+            return;
+
+        m_atoms.erase(m_strings[atom - 1]);
+
+        m_strings[atom - 1].clear();
+        m_strings[atom - 1].shrink_to_fit();
+        m_free.emplace_back(atom);
+    }
+
+    // doesn't intern or take a reference, INVALID if str isn't interned
+    uint32_t find(const std::string_view& str) const {
+        auto it = m_atoms.find(str);
+        if (it == m_atoms.end())
+            return INVALID;
+
+        return it->second;
+    }
+
+    // valid for as long as a reference to atom is held
+    const std::string& str(uint32_t atom) const {
+        return m_strings[atom - 1];
+    }
+
+    // atoms currently in use
+    size_t size() const {
+        return m_atoms.size();
+    }
+
+  private:
+    std::deque<std::string>                        m_strings;
+    std::vector<uint32_t>                          m_refs;
+    std::vector<uint32_t>                          m_free;
+    std::unordered_map<std::string_view, uint32_t> m_atoms;
+};
+
+inline UP<CAtomTable> g_atoms = makeUnique<CAtomTable>();
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+
+// Dense bitmap, operated on a word at a time. Used for evaluating set expressions.
+class CBitmap {
+  public:
+    void set(uint32_t bit) {
+        const auto WORD = bit / 64;
+        if (WORD >= m_words.size())
+            m_words.resize(WORD + 1, 0);
+
+        m_words[WORD] |= 1ULL << (bit % 64);
+    }
+
+    void clear(uint32_t bit) {
+        const auto WORD = bit / 64;
+        if (WORD >= m_words.size())
+            return;
+
+        m_words[WORD] &= ~(1ULL << (bit % 64));
+    }
+
+    bool test(uint32_t bit) const {
+        const auto WORD = bit / 64;
+        if (WORD >= m_words.size())
+            return false;
+
+        return m_words[WORD] & (1ULL << (bit % 64));
+    }
+
+    CBitmap& operator&=(const CBitmap& other) {
+        if (m_words.size() > other.m_words.size())
+            m_words.resize(other.m_words.size());
+
+        for (size_t i = 0; i < m_words.size(); ++i) {
+            m_words[i] &= other.m_words[i];
+        }
+
+        return *this;
+    }
+
+    CBitmap& operator|=(const CBitmap& other) {
+        if (m_words.size() < other.m_words.size())
+            m_words.resize(other.m_words.size(), 0);
+
+        for (size_t i = 0; i < other.m_words.size(); ++i) {
+            m_words[i] |= other.m_words[i];
+        }
+
+        return *this;
+    }
+
+    bool empty() const {
+        return std::ranges::all_of(m_words, [](const auto& w) { return w == 0; });
+    }
+
+    size_t count() const {
+        size_t c = 0;
+        for (const auto& w : m_words) {
+            c += std::popcount(w);
+        }
+        return c;
+    }
+
+    // calls fn(bit) for every set bit, in ascending order
+    template <typename F>
+    void forEach(F&& fn) const {
+        for (size_t i = 0; i < m_words.size(); ++i) {
+            uint64_t w = m_words[i];
+            while (w) {
+                const uint32_t BIT = i * 64 + std::countr_zero(w);
+                fn(BIT);
+                w &= w - 1;
+            }
+        }
+    }
+
+  private:
+    std::vector<uint64_t> m_words;
+};
+
+// Bitmap for storage: a sorted list of bits while sparse, dense words once it fills up.
+// Most per-property sets only hold a couple of objects, this keeps them from costing a
+// word per 64 live slots each.
+class CCompressedBitmap {
+  public:
+    void set(uint32_t bit) {
+        if (m_isDense) {
+            if (!m_dense.test(bit)) {
+                m_dense.set(bit);
+                m_count++;
+            }
+            return;
+        }
+
+        auto it = std::ranges::lower_bound(m_sparse, bit);
+        if (it != m_sparse.end() && *it == bit)
+            return;
+
+        m_sparse.insert(it, bit);
+        m_count++;
+
+        if (m_sparse.size() > SPARSE_MAX)
+            densify();
+    }
+
+    void clear(uint32_t bit) {
+        if (m_isDense) {
+            if (m_dense.test(bit)) {
+                m_dense.clear(bit);
+                m_count--;
+            }
+
+            if (m_count < SPARSE_MAX / 2)
+                sparsify();
+            return;
+        }
+
+        auto it = std::ranges::lower_bound(m_sparse, bit);
+        if (it == m_sparse.end() || *it != bit)
+            return;
+
+        m_sparse.erase(it);
+        m_count--;
+    }
+
+    bool test(uint32_t bit) const {
+        if (m_isDense)
+            return m_dense.test(bit);
+
+        return std::ranges::binary_search(m_sparse, bit);
+    }
+
+    bool empty() const {
+        return m_count == 0;
+    }
+
+    size_t count() const {
+        return m_count;
+    }
+
+    void orInto(CBitmap& out) const {
+        if (m_isDense) {
+            out |= m_dense;
+            return;
+        }
+
+        for (const auto& b : m_sparse) {
+            out.set(b);
+        }
+    }
+
+    CBitmap toBitmap() const {
+        CBitmap b;
+        orInto(b);
+        return b;
+    }
+
+  private:
+    void densify() {
+        for (const auto& b : m_sparse) {
+            m_dense.set(b);
+        }
+
+        m_sparse.clear();
+        m_sparse.shrink_to_fit();
+        m_isDense = true;
+    }
+
+    void sparsify() {
+        m_sparse.clear();
+        m_dense.forEach([this](uint32_t b) { m_sparse.emplace_back(b); });
+        m_dense   = CBitmap{};
+        m_isDense = false;
+    }
+
+    constexpr static size_t SPARSE_MAX = 256;
+
+    // m_sparse is used until the set outgrows SPARSE_MAX
+    bool                  m_isDense = false;
+    size_t                m_count   = 0;
+    std::vector<uint32_t> m_sparse;
+    CBitmap               m_dense;
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <functional>
+
+// transparent hash, lets string-keyed maps be looked up with string_views / c strings
+struct SStringHash {
+    using is_transparent = void;
+
+    size_t operator()(const std::string_view& sv) const {
+        return std::hash<std::string_view>{}(sv);
+    }
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <bit>
+#include <cstdint>
+
+// Set of security permission types (hpHyprtavernCoreV1SecurityPermissionType), one bit each.
+// Checking one or many permissions is a single AND.
+struct SPermissionSet {
+    constexpr static uint32_t MAX  = 64;
+
+    uint64_t                  bits = 0;
+
+    // false if the type is out of range and wasn't added
+    bool add(uint32_t perm) {
+        if (perm >= MAX)
+            return false;
+
+        bits |= 1ULL << perm;
+        return true;
+    }
+
+    bool has(uint32_t perm) const {
+        return perm < MAX && (bits & (1ULL << perm));
+    }
+
+    bool hasAll(const SPermissionSet& other) const {
+        return (bits & other.bits) == other.bits;
+    }
+
+    bool empty() const {
+        return !bits;
+    }
+
+    SPermissionSet operator|(const SPermissionSet& other) const {
+        return SPermissionSet{.bits = bits | other.bits};
+    }
+
+    bool operator==(const SPermissionSet& other) const = default;
+
+    // lowest first. Fills out in place, so a kept around vector doesn't reallocate
+    void toVector(std::vector<uint32_t>& out) const {
+        out.clear();
+
+        for (uint64_t rest = bits; rest; rest &= rest - 1) {
+            out.emplace_back(std::countr_zero(rest));
+        }
+    }
+
+    static SPermissionSet fromVector(const std::vector<uint32_t>& perms) {
+        SPermissionSet set;
+
+        for (const auto& p : perms) {
+            set.add(p);
+        }
+
+        return set;
+    }
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <optional>
+#include <cstddef>
+
+// Bounded queue between exactly one pushing and one popping thread. Neither side ever takes a lock or waits on the other,
+// a full queue just refuses the push. N has to be a power of two.
+template <typename T, size_t N>
+class CSPSCQueue {
+    static_assert(N && (N & (N - 1)) == 0, "CSPSCQueue size has to be a power of two");
+
+  public:
+    // producer only
+    bool push(T&& value) {
+        const size_t TAIL = m_tail.load(std::memory_order_relaxed);
+
+        if (TAIL - m_head.load(std::memory_order_acquire) == N)
+            return false;
+
+        m_slots[TAIL & (N - 1)] = std::move(value);
+        m_tail.store(TAIL + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only
+    std::optional<T> pop() {
+        const size_t HEAD = m_head.load(std::memory_order_relaxed);
+
+        if (HEAD == m_tail.load(std::memory_order_acquire))
+            return std::nullopt;
+
+        auto value = std::move(m_slots[HEAD & (N - 1)]);
+        m_slots[HEAD & (N - 1)].reset();
+        m_head.store(HEAD + 1, std::memory_order_release);
+        return value;
+    }
+
+  private:
+    std::array<std::optional<T>, N> m_slots;
+
+    // on separate cache lines, each is written by one side only
+    alignas(64) std::atomic<size_t> m_head = 0;
+    alignas(64) std::atomic<size_t> m_tail = 0;
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Memory.hpp"
+
+// Generational slot map. Insert, lookup and removal are O(1), and values are kept
+// densely packed for iteration.
+// Ids are (generation << INDEX_BITS) | index, and never 0. A removed id will never resolve again:
+// the slot's generation is bumped on removal, and a slot whose generation runs out is retired for good.
+template <typename T>
+class CSlotMap {
+  public:
+    constexpr static uint32_t INDEX_BITS     = 20;
+    constexpr static uint32_t INDEX_MASK     = (1U << INDEX_BITS) - 1;
+    constexpr static uint32_t MAX_GENERATION = (1U << (32 - INDEX_BITS)) - 1;
+
+    // returns the new id, or 0 if the map is full
+    uint32_t insert(const SP<T>& value) {
+        uint32_t index = 0;
+
+        if (!m_free.empty()) {
+            index = m_free.back();
+            m_free.pop_back();
+        } else {
+            if (m_slots.size() > INDEX_MASK)
+                return 0;
+
+            index = m_slots.size();
+            m_slots.emplace_back();
+        }
+
+        auto& slot = m_slots[index];
+        slot.dense = m_dense.size();
+
+        m_dense.emplace_back(value);
+        m_denseToSlot.emplace_back(index);
+
+        return (slot.generation << INDEX_BITS) | index;
+    }
+
+    SP<T> get(uint32_t id) const {
+        const auto SLOT = slotFor(id);
+        if (!SLOT)
+            return nullptr;
+
+        return m_dense[SLOT->dense];
+    }
+
+    bool contains(uint32_t id) const {
+        return slotFor(id);
+    }
+
+    bool remove(uint32_t id) {
+        const auto SLOT = slotFor(id);
+        if (!SLOT)
+            return false;
+
+        const uint32_t INDEX = id & INDEX_MASK;
+        const uint32_t DENSE = SLOT->dense;
+
+        // keep the value alive until the map is consistent again, its destructor might call back into us
+        SP<T> removed = std::move(m_dense[DENSE]);
+
+        // move the last value into the hole
+        if (DENSE != m_dense.size() - 1) {
+            m_dense[DENSE]                      = std::move(m_dense.back());
+            m_denseToSlot[DENSE]                = m_denseToSlot.back();
+            m_slots[m_denseToSlot[DENSE]].dense = DENSE;
+        }
+
+        m_dense.pop_back();
+        m_denseToSlot.pop_back();
+
+        auto& slot = m_slots[INDEX];
+        slot.dense = INVALID_DENSE;
+
+        if (slot.generation < MAX_GENERATION) {
+            slot.generation++;
+            m_free.emplace_back(INDEX);
+        }
+
+        removed.reset();
+
+        return true;
+    }
+
+    size_t size() const {
+        return m_dense.size();
+    }
+
+    bool empty() const {
+        return m_dense.empty();
+    }
+
+    // insert() would return 0. Check before building anything that can't be torn down again if it does
+    bool full() const {
+        return m_free.empty() && m_slots.size() > INDEX_MASK;
+    }
+
+    auto begin() const {
+        return m_dense.begin();
+    }
+
+    auto end() const {
+        return m_dense.end();
+    }
+
+  private:
+    constexpr static uint32_t INVALID_DENSE = UINT32_MAX;
+
+    struct SSlot {
+        uint32_t generation = 1;
+        uint32_t dense      = INVALID_DENSE;
+    };
+
+    const SSlot* slotFor(uint32_t id) const {
+        const uint32_t INDEX      = id & INDEX_MASK;
+        const uint32_t GENERATION = id >> INDEX_BITS;
+
+        if (INDEX >= m_slots.size())
+            return nullptr;
+
+        const auto& SLOT = m_slots[INDEX];
+
+        if (SLOT.generation != GENERATION || SLOT.dense == INVALID_DENSE)
+            return nullptr;
+
+        return &SLOT;
+    }
+
+    std::vector<SSlot>    m_slots;
+    std::vector<uint32_t> m_free;
+
+    std::vector<SP<T>>    m_dense;
+    std::vector<uint32_t> m_denseToSlot;
+};
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+// Hierarchical timer wheel. Scheduling is O(1), and advancing costs O(1) per tick plus the timers that fire or
+// move down a level. What a tick is worth is up to the caller.
+// Cancelling needs the tick schedule() returned, and costs a scan of the one slot the timer can be in.
+template <typename T>
+class CTimerWheel {
+  public:
+    constexpr static size_t   LEVELS     = 4;
+    constexpr static uint32_t SLOT_BITS  = 6;
+    constexpr static size_t   SLOTS      = 1ULL << SLOT_BITS;
+    constexpr static uint64_t SLOT_MASK  = SLOTS - 1;
+    constexpr static uint64_t WHEEL_BITS = LEVELS * SLOT_BITS;
+
+    // fires at now() + delay, or the next tick if delay is 0. Returns the tick it fires at
+    uint64_t schedule(T value, uint64_t delay) {
+        const uint64_t EXPIRES = m_now + (delay ? delay : 1);
+
+        insert(SEntry{.value = std::move(value), .expires = EXPIRES});
+        m_size++;
+
+        return EXPIRES;
+    }
+
+    // a timer that already fired isn't found, that's fine
+    void cancel(const T& value, uint64_t expires) {
+        if (expires <= m_now)
+            return;
+
+        auto& slot = slotFor(expires);
+        auto  it   = std::ranges::find_if(slot, [&value, expires](const auto& e) { return e.expires == expires && e.value == value; });
+
+        if (it == slot.end())
+            return;
+
+        // order within a slot doesn't matter
+        std::swap(*it, slot.back());
+        slot.pop_back();
+        m_size--;
+    }
+
+    // the earliest tick anything fires at. Entries on a level all fire before the ones on the levels above,
+    // so this is the first non-empty slot from the bottom up
+    std::optional<uint64_t> nextExpiry() const {
+        if (!m_size)
+            return std::nullopt;
+
+        for (size_t level = 0; level < LEVELS; ++level) {
+            const uint64_t CURRENT = (m_now >> (level * SLOT_BITS)) & SLOT_MASK;
+
+            for (uint64_t i = CURRENT + 1; i < SLOTS; ++i) {
+                if (!m_levels[level][i].empty())
+                    return earliest(m_levels[level][i]);
+            }
+        }
+
+        return earliest(m_overflow);
+    }
+
+    // moves the wheel up to tick now, calling fn(value) for everything that expires on the way
+    template <typename F>
+    void advance(uint64_t now, F&& fn) {
+        while (m_now < now) {
+            if (!m_size) {
+                m_now = now;
+                return;
+            }
+
+            m_now++;
+
+            // the level above just wrapped into a new slot, spread it out onto the lower ones
+            if ((m_now & ((1ULL << WHEEL_BITS) - 1)) == 0)
+                cascade(m_overflow);
+
+            for (size_t level = LEVELS - 1; level > 0; --level) {
+                if ((m_now & ((1ULL << (level * SLOT_BITS)) - 1)) == 0)
+                    cascade(m_levels[level][(m_now >> (level * SLOT_BITS)) & SLOT_MASK]);
+            }
+
+            auto expired = std::move(m_levels[0][m_now & SLOT_MASK]);
+            m_levels[0][m_now & SLOT_MASK].clear();
+
+            m_size -= expired.size();
+
+            for (auto& e : expired) {
+                fn(e.value);
+            }
+        }
+    }
+
+    uint64_t now() const {
+        return m_now;
+    }
+
+    // pending timers
+    size_t size() const {
+        return m_size;
+    }
+
+  private:
+    struct SEntry {
+        T        value;
+        uint64_t expires = 0;
+    };
+
+    // the lowest level whose current rotation expires falls into. advance() cascades entries down as the rotations
+    // move on, so a pending entry is always in the slot this returns for it
+    std::vector<SEntry>& slotFor(uint64_t expires) {
+        for (size_t level = 0; level < LEVELS; ++level) {
+            const uint32_t ABOVE = (level + 1) * SLOT_BITS;
+
+            if ((expires >> ABOVE) == (m_now >> ABOVE))
+                return m_levels[level][(expires >> (level * SLOT_BITS)) & SLOT_MASK];
+        }
+
+        return m_overflow;
+    }
+
+    void insert(SEntry&& e) {
+        slotFor(e.expires).emplace_back(std::move(e));
+    }
+
+    static std::optional<uint64_t> earliest(const std::vector<SEntry>& slot) {
+        if (slot.empty())
+            return std::nullopt;
+
+        return std::ranges::min(slot, {}, &SEntry::expires).expires;
+    }
+
+    void cascade(std::vector<SEntry>& slot) {
+        auto entries = std::move(slot);
+        slot.clear();
+
+        for (auto& e : entries) {
+            insert(std::move(e));
+        }
+    }
+
+    uint64_t                                                   m_now  = 0;
+    size_t                                                     m_size = 0;
+
+    std::array<std::array<std::vector<SEntry>, SLOTS>, LEVELS> m_levels;
+
+    // further out than the wheel reaches
+    std::vector<SEntry> m_overflow;
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <optional>
+#include <format>
+#include <cstdint>
+
+// 128 random bits. Only turned into text (uuid-style hex) at the wire boundary.
+struct SToken {
+    uint64_t hi = 0, lo = 0;
+
+    // never handed out, stands for "no token"
+    bool empty() const {
+        return hi == 0 && lo == 0;
+    }
+
+    bool operator==(const SToken& other) const = default;
+
+    // uuid-style
+    std::string toString() const {
+        return std::format("{:08x}-{:04x}-{:04x}-{:04x}-{:012x}", hi >> 32, (hi >> 16) & 0xFFFF, hi & 0xFFFF, lo >> 48, lo & 0xFFFFFFFFFFFFULL);
+    }
+
+    // accepts what toString produces, in either case
+    static std::optional<SToken> fromString(const std::string_view& str) {
+        if (str.size() != 36)
+            return std::nullopt;
+
+        SToken token;
+        size_t nibbles = 0;
+
+        for (size_t i = 0; i < str.size(); ++i) {
+            const char C = str[i];
+
+            if (i == 8 || i == 13 || i == 18 || i == 23) {
+                if (C != '-')
+                    return std::nullopt;
+                continue;
+            }
+
+            uint64_t nibble = 0;
+            if (C >= '0' && C <= '9')
+                nibble = C - '0';
+            else if (C >= 'a' && C <= 'f')
+                nibble = C - 'a' + 10;
+            else if (C >= 'A' && C <= 'F')
+                nibble = C - 'A' + 10;
+            else
+                return std::nullopt;
+
+            auto& word = nibbles < 16 ? token.hi : token.lo;
+            word       = (word << 4) | nibble;
+            nibbles++;
+        }
+
+        return token;
+    }
+};
+
+// tokens are random already, folding the halves is enough
+struct STokenHash {
+    size_t operator()(const SToken& token) const {
+        return token.hi ^ token.lo;
+    }
+};
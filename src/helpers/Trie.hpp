@@ -0,0 +1,131 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+// Byte-wise prefix trie mapping strings to a value. Nodes live in one vector and are recycled,
+// children are kept in small sorted arrays.
+template <typename T>
+class CPrefixTrie {
+  public:
+    CPrefixTrie() {
+        m_nodes.emplace_back();
+    }
+
+    void insert(const std::string_view& key, T value) {
+        uint32_t node = ROOT;
+
+        for (const char c : key) {
+            auto child = childOf(node, c);
+
+            if (child == INVALID) {
+                child = allocNode();
+
+                auto& children = m_nodes[node].children;
+                children.insert(std::ranges::lower_bound(children, c, {}, &SChild::c), SChild{.c = c, .node = child});
+            }
+
+            node = child;
+        }
+
+        m_nodes[node].value    = std::move(value);
+        m_nodes[node].hasValue = true;
+    }
+
+    void erase(const std::string_view& key) {
+        std::vector<uint32_t> path;
+        path.reserve(key.size() + 1);
+        path.emplace_back(ROOT);
+
+        for (const char c : key) {
+            const auto CHILD = childOf(path.back(), c);
+            if (CHILD == INVALID)
+                return;
+
+            path.emplace_back(CHILD);
+        }
+
+        m_nodes[path.back()].hasValue = false;
+        m_nodes[path.back()].value    = T{};
+
+        // prune the now-empty branch
+        for (size_t i = path.size() - 1; i > 0; --i) {
+            auto& n = m_nodes[path[i]];
+            if (n.hasValue || !n.children.empty())
+                break;
+
+            auto& parentChildren = m_nodes[path[i - 1]].children;
+            std::erase_if(parentChildren, [c = key[i - 1]](const auto& e) { return e.c == c; });
+
+            m_free.emplace_back(path[i]);
+        }
+    }
+
+    // calls fn(value) for every key starting with prefix
+    template <typename F>
+    void forEachWithPrefix(const std::string_view& prefix, F&& fn) const {
+        uint32_t node = ROOT;
+
+        for (const char c : prefix) {
+            node = childOf(node, c);
+            if (node == INVALID)
+                return;
+        }
+
+        std::vector<uint32_t> stack = {node};
+
+        while (!stack.empty()) {
+            const auto& N = m_nodes[stack.back()];
+            stack.pop_back();
+
+            if (N.hasValue)
+                fn(N.value);
+
+            for (const auto& child : N.children) {
+                stack.emplace_back(child.node);
+            }
+        }
+    }
+
+  private:
+    constexpr static uint32_t ROOT    = 0;
+    constexpr static uint32_t INVALID = UINT32_MAX;
+
+    struct SChild {
+        char     c    = 0;
+        uint32_t node = INVALID;
+    };
+
+    struct SNode {
+        std::vector<SChild> children;
+        T                   value    = T{};
+        bool                hasValue = false;
+    };
+
+    uint32_t childOf(uint32_t node, char c) const {
+        const auto& CHILDREN = m_nodes[node].children;
+        auto        it       = std::ranges::lower_bound(CHILDREN, c, {}, &SChild::c);
+
+        if (it == CHILDREN.end() || it->c != c)
+            return INVALID;
+
+        return it->node;
+    }
+
+    uint32_t allocNode() {
+        if (!m_free.empty()) {
+            const auto NODE = m_free.back();
+            m_free.pop_back();
+            m_nodes[NODE] = SNode{};
+            return NODE;
+        }
+
+        m_nodes.emplace_back();
+        return m_nodes.size() - 1;
+    }
+
+    std::vector<SNode>    m_nodes;
+    std::vector<uint32_t> m_free;
+};
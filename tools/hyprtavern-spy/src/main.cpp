@@ -154,40 +154,52 @@ int main(int argc, char** argv, char** envp) {
         else
             std::println("There are {} objects in the tavern:", ids.size());
 
-        for (const auto& id : ids) {
-            auto                     handle = makeShared<CCHpHyprtavernBusObjectHandleV1Object>(manager->sendGetObjectHandle(id));
-
-            std::string              name;
-            std::vector<std::string> protocols;
-            std::vector<uint32_t>    revs;
-            std::vector<std::string> props;
-
-            handle->setName([&name](const char* str) { name = str; });
-            handle->setProperties([&props](const std::vector<const char*>& p) {
+        struct SObjectInfo {
+            uint32_t                                  id = 0;
+            SP<CCHpHyprtavernBusObjectHandleV1Object> handle;
+            std::string                               name;
+            std::vector<std::string>                  protocols;
+            std::vector<uint32_t>                     revs;
+            std::vector<std::string>                  props;
+        };
+
+        // the vector is never resized after this, so the callbacks can hold on to the elements
+        std::vector<SObjectInfo> objects(ids.size());
+
+        // request every handle first, then wait for all of them in one roundtrip
+        for (size_t i = 0; i < ids.size(); ++i) {
+            auto& obj  = objects.at(i);
+            obj.id     = ids.at(i);
+            obj.handle = makeShared<CCHpHyprtavernBusObjectHandleV1Object>(manager->sendGetObjectHandle(obj.id));
+
+            obj.handle->setName([&obj](const char* str) { obj.name = str; });
+            obj.handle->setProperties([&obj](const std::vector<const char*>& p) {
                 for (const auto& pp : p) {
-                    props.emplace_back(pp);
+                    obj.props.emplace_back(pp);
                 }
             });
-            handle->setProtocols([&protocols, &revs](const std::vector<const char*>& pn, const std::vector<uint32_t>& pr) {
+            obj.handle->setProtocols([&obj](const std::vector<const char*>& pn, const std::vector<uint32_t>& pr) {
                 for (const auto& x : pn) {
-                    protocols.emplace_back(x);
+                    obj.protocols.emplace_back(x);
                 }
 
                 for (const auto& x : pr) {
-                    revs.emplace_back(x);
+                    obj.revs.emplace_back(x);
                 }
             });
+        }
 
-            sock->roundtrip();
+        sock->roundtrip();
 
-            std::println(" ┣╸{}#{}:", name, id);
-            std::println(" ┃   ┣╸protocols:", name, id);
-            for (size_t i = 0; i < protocols.size(); ++i) {
-                std::println(" ┃   ┃   {}╸{}@{}", i == protocols.size() - 1 ? "┗" : "┣", protocols.at(i), revs.at(i));
+        for (const auto& obj : objects) {
+            std::println(" ┣╸{}#{}:", obj.name, obj.id);
+            std::println(" ┃   ┣╸protocols:");
+            for (size_t i = 0; i < obj.protocols.size(); ++i) {
+                std::println(" ┃   ┃   {}╸{}@{}", i == obj.protocols.size() - 1 ? "┗" : "┣", obj.protocols.at(i), obj.revs.at(i));
             }
             std::println(" ┃   ┗╸props:");
-            for (size_t i = 0; i < props.size(); ++i) {
-                std::println(" ┃       {}╸{}", i == props.size() - 1 ? "┗" : "┣", props.at(i));
+            for (size_t i = 0; i < obj.props.size(); ++i) {
+                std::println(" ┃       {}╸{}", i == obj.props.size() - 1 ? "┗" : "┣", obj.props.at(i));
             }
         }
 